@@ -8,12 +8,17 @@
 
 #include <iostream>
 #include "vec3.h"
+#include "framebuffer.h"
+#include "image_writer.h"
 
-int main()
+//writes to the path given (format from its extension), or binary PPM on stdout
+int main(int argc, char **argv)
 {
     int width = 200;
     int height = 100;
-    std::cout << "P3\n" << width << " " << height << "\n255\n";
+    const char *out_path = argc > 1 ? argv[1] : "-";
+
+    framebuffer fb(width, height);
     for (int j = height - 1; j >= 0; j--)
     {
         for (int i = 0; i < width; i++)
@@ -24,12 +29,16 @@ int main()
             // float r = float(i) / float(width);
             // float g = float(j) / float(height);
             // float b = 0.2;
-            int ir = int(255.99 * col[0]);
-            int ig = int(255.99 * col[1]);
-            int ib = int(255.99 * col[2]); //why 255.99?
-            std::cout << ir << " " << ig << " " << ib << "\n";
+            fb.set(i, j, col);
         }
     }
 
-    //TODO: write out to file (implemented in SimpleRayTracer, not here)
-}
\ No newline at end of file
+    //the gradient is written as-is, without gamma correction
+    image_output out(out_path, width, height, format_from_path(out_path), 16, false);
+    out.write_all(fb);
+    if (!out.finish())
+    {
+        std::cerr << "couldn't write " << out_path << "\n";
+        return 1;
+    }
+}
@@ -7,158 +7,891 @@
  * Fall 2019
  */
 
-#include <stdlib.h> //for drand48
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
 #include "float.h"
 #include "sphere.h"
 #include "hitable_list.h"
+#include "bvh.h"
+#include "sphere_batch.h"
 #include "camera.h"
 #include "lambertian.h"
 #include "metal.h"
 #include "dielectric.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "render_scheduler.h"
+#include "renderer.h"
+#include "wavefront.h"
+#include "progressive.h"
+#include "preview.h"
+#include "distributed.h"
+#include "denoiser.h"
+#include "animation.h"
+#include "closed_world.h"
+#include "rng.h"
+#include "sampler.h"
+#include "adaptive_sampling.h"
 
-/* returns the color at the point intersected in the given world by the given ray
- * runs recursively for scattering rays; depth indicates recursion depth
- */
-vec3 color(const ray& r, hitable *world, int depth)
+int main(int argc, char **argv)
 {
-    hit_record rec;
+    int width = 200;
+    int height = 100;
+    int num_samples = 100;
+    adaptive_settings adaptive;
+    path_settings path;
+    sampler_type sampler_kind = sampler_independent;
+    int num_threads = 0; //0 means one per hardware thread
+    int tile_size = 16;
+    int grid = 11;
+    bool lit = false;            //lit_scene() instead of random_scene()
+    bool use_bvh = true;
+    bool use_batches = false;
+    sphere_isa isa = isa_auto;
+    int packet_size = 0; //0 traces camera rays one at a time
+    bool wavefront = false;
+    bool use_closed_world = false; //single rays without virtual calls, if the scene allows
+    const char *scene_path = 0;  //0 builds random_scene()
+    const char *export_path = 0; //writes the scene out as text instead of rendering
+    const char *stats_path = 0;  //JSON report of the render statistics, if built with RT_STATS
+    int passes = 0;              //0 renders every sample in one go; more renders progressively
+    const char *checkpoint_path = 0; //defaults to the output path + ".checkpoint"
+    double checkpoint_secs = 60;
+    bool resume = false;
+    int num_workers = 0;         //worker processes to fork; 0 renders in this process
+    int listen_port = 0;         //also take remote workers on this TCP port
+    const char *coordinator = 0; //host:port to work for, instead of rendering an image
+    bool denoising = false;      //filters the image with the denoiser before writing it
+    bool write_aov_images = false; //also writes the normal, albedo and depth buffers next to the image
+    int num_frames = 0;          //0 renders a single image; more renders a numbered sequence
+    float fps = 24;
+    animation anim;              //camera keys from --key go straight in
+    float orbit_secs = 0;        //seconds per turn of a turntable around lookat; 0 = none
+    float bounce_height = 0;     //how high the small spheres bounce; 0 = they stay put
+    const char *preview_path = 0; //publishes coarse-to-fine passes here for a viewer, taking commands on stdin
+    const char *out_path = "ray-trace-out.ppm";
 
-    //if intersection, color based on surface normal
-    //min t is 0.001 to get rid of shadow acne (hits at t's very close to 0)
-    if (world->hit(r, 0.001, MAXFLOAT, rec))
+    for (int a = 1; a < argc; a++)
     {
-        ray scattered;
-        vec3 attenuation;
+        if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+        {
+            num_threads = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--tile") == 0 && a + 1 < argc)
+        {
+            tile_size = atoi(argv[++a]);
+            if (tile_size < 1)
+            {
+                std::cerr << "--tile needs a size of at least 1\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[a], "--samples") == 0 && a + 1 < argc)
+        {
+            num_samples = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--adaptive") == 0)
+        {
+            adaptive.enabled = true;
+        }
+        else if (strcmp(argv[a], "--min-samples") == 0 && a + 1 < argc)
+        {
+            adaptive.min_samples = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--threshold") == 0 && a + 1 < argc)
+        {
+            adaptive.threshold = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--max-depth") == 0 && a + 1 < argc)
+        {
+            path.max_depth = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--rr-depth") == 0 && a + 1 < argc)
+        {
+            path.rr_depth = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--no-light-sampling") == 0)
+        {
+            path.light_sampling = false;
+        }
+        else if (strcmp(argv[a], "--rr-min") == 0 && a + 1 < argc)
+        {
+            path.rr_min_survival = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--sampler") == 0 && a + 1 < argc)
+        {
+            sampler_kind = find_sampler(argv[++a]);
+            if (sampler_kind == sampler_type_count)
+            {
+                std::cerr << "unknown sampler " << argv[a] << "; try independent, stratified, sobol or bluenoise\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[a], "--grid") == 0 && a + 1 < argc)
+        {
+            grid = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--lit") == 0)
+        {
+            lit = true;
+        }
+        else if (strcmp(argv[a], "--scene") == 0 && a + 1 < argc)
+        {
+            scene_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--export-scene") == 0 && a + 1 < argc)
+        {
+            export_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--stats") == 0 && a + 1 < argc)
+        {
+            stats_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--passes") == 0 && a + 1 < argc)
+        {
+            passes = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc)
+        {
+            checkpoint_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--checkpoint-every") == 0 && a + 1 < argc)
+        {
+            checkpoint_secs = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--resume") == 0)
+        {
+            resume = true;
+        }
+        else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc)
+        {
+            num_workers = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--listen") == 0 && a + 1 < argc)
+        {
+            listen_port = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--worker") == 0 && a + 1 < argc)
+        {
+            coordinator = argv[++a];
+        }
+        else if (strcmp(argv[a], "--preview") == 0 && a + 1 < argc)
+        {
+            preview_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--denoise") == 0)
+        {
+            denoising = true;
+        }
+        else if (strcmp(argv[a], "--aovs") == 0)
+        {
+            write_aov_images = true;
+        }
+        else if (strcmp(argv[a], "--frames") == 0 && a + 1 < argc)
+        {
+            num_frames = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--fps") == 0 && a + 1 < argc)
+        {
+            fps = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--key") == 0 && a + 7 < argc)
+        {
+            //--key time from_x from_y from_z at_x at_y at_z
+            float k[7];
+            for (int i = 0; i < 7; i++)
+            {
+                k[i] = atof(argv[++a]);
+            }
+            anim.add_camera_key(k[0], vec3(k[1], k[2], k[3]), vec3(k[4], k[5], k[6]));
+        }
+        else if (strcmp(argv[a], "--orbit") == 0 && a + 1 < argc)
+        {
+            orbit_secs = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--bounce") == 0 && a + 1 < argc)
+        {
+            bounce_height = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--no-bvh") == 0)
+        {
+            use_bvh = false;
+        }
+        else if (strcmp(argv[a], "--packet") == 0 && a + 1 < argc)
+        {
+            packet_size = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--wavefront") == 0)
+        {
+            wavefront = true;
+        }
+        else if (strcmp(argv[a], "--closed-world") == 0)
+        {
+            use_closed_world = true;
+        }
+        else if (strcmp(argv[a], "--batch") == 0)
+        {
+            use_batches = true;
+        }
+        else if (strcmp(argv[a], "--isa") == 0 && a + 1 < argc)
+        {
+            a++;
+            use_batches = true;
+            isa = sphere_batch::find_isa(argv[a]);
+            if (isa == isa_count)
+            {
+                std::cerr << "unknown isa " << argv[a] << "; try auto, scalar, avx2 or avx512\n";
+                return 1;
+            }
+            if (!sphere_batch::isa_supported(isa))
+            {
+                std::cerr << "this CPU can't run the " << argv[a] << " sphere kernels\n";
+                return 1;
+            }
+        }
+        else
+        {
+            out_path = argv[a];
+        }
+    }
 
-        if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+    //hitable *list[4];
+    //----------------------version up to ch 9
+    // list[0] = new sphere( vec3(0, 0, -1), 0.5, new lambertian(vec3(0.8, 0.3, 0.3)) );
+    // list[1] = new sphere( vec3(0, -100.5, -1), 100, new lambertian(vec3(0.8, 0.8, 0.0)) ); //basically the floor
+    // list[2] = new sphere( vec3(1, 0, -1), 0.5, new dielectric(1.5) );
+    //list[3] = new sphere( vec3(1, 0, -1), -0.45, new dielectric(1.5) ); //inner sphere for bubble
+    // list[3] = new sphere( vec3(-1, 0, -1), 0.5, new metal(vec3(0.8, 0.8, 0.8), 0.2) );
+    //----------------------version for ch 10 pt 1
+    // float R = cos(M_PI/4.0);
+    // list[0] = new sphere( vec3(-R, 0, -1), R, new lambertian(vec3(0, 0, 1)) );
+    // list[1] = new sphere( vec3(R, 0, -1), R, new lambertian(vec3(1, 0, 0)) );
+    //----------------------
+    //hitable *world = new hitable_list(list, 4);
+
+    camera_params view; //defaults to the cover scene's camera
+    scene sc;
+    uint64_t scene_hash = 0; //of the scene file's contents, for the fingerprint
+    auto load_start = std::chrono::steady_clock::now();
+    if (scene_path)
+    {
+        std::string error;
+        bool from_cache;
+        if (!load_scene(scene_path, sc, view, error, from_cache, scene_hash, num_threads))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        std::cerr << "loaded " << scene_path << (from_cache ? " compiled" : " from text") << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count()
+                  << " ms\n";
+    }
+    else
+    {
+        rng scene_gen(2019); //fixed seed so every run builds the same scene
+        if (lit)
         {
-            return attenuation * color(scattered, world, depth+1);
+            lit_scene(sc, scene_gen, grid);
         }
         else
         {
-            return vec3(0, 0, 0);
+            random_scene(sc, scene_gen, grid);
         }
     }
 
-    //no intersection
-    vec3 unit_direction = vec3::unit_vector(r.direction());
-    float t = 0.5*(unit_direction.y() + 1.0); //how far along y
-    return vec3::scale( vec3(1.0, 1.0, 1.0), (1.0-t) ) + vec3::scale( vec3(0.5, 0.7, 1.0), t);
-    //linear interpolation (gradient) between white and blue
-}
+    if (export_path)
+    {
+        std::string error;
+        if (!write_scene_text(export_path, sc, view, error))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        return 0;
+    }
 
-hitable *random_scene()
-{
-    int n = 500;
-    hitable **list = new hitable*[n+1];
+    //         look from, look at, vup, vfov and aperture from the scene; aspect ratio from the image
+    camera cam = view.make_camera(float(width)/float(height));
+
+    accel_settings accel;
+    accel.use_bvh = use_bvh;
+    accel.use_batches = use_batches;
+    accel.isa = isa;
+    accel.num_threads = num_threads;
+    sc.build(accel);
+
+    std::cerr << "scene: " << sc.objects.size() << " objects, " << sc.materials.size() << " materials, "
+              << sc.bytes_used() / 1024 << " KB\n";
+    if (use_batches)
+    {
+        std::cerr << "sphere batches: " << sc.list->list_size - sc.unbounded.size() << " using "
+                  << sphere_batch::isa_name(isa == isa_auto ? sphere_batch::detect_isa() : isa) << "\n";
+    }
+    if (sc.tree)
+    {
+        std::cerr << "bvh: " << sc.tree->prims.size() << " objects, " << sc.tree->tree.nodes.size() << " nodes, built in "
+                  << sc.tree->tree.build_ms << " ms";
+        if (!sc.unbounded.empty())
+        {
+            std::cerr << " (plus " << sc.unbounded.size() << " unbounded, tested first)";
+        }
+        std::cerr << "\n";
+    }
+    if (packet_size != 0 && (!sc.tree || (packet_size != 4 && packet_size != 8 && packet_size != 16)))
+    {
+        std::cerr << "packets need the bvh and a size of 4, 8 or 16; tracing single rays\n";
+        packet_size = 0;
+    }
+    closed_world closed;
+    if (use_closed_world)
+    {
+        std::string why_not;
+        if (packet_size != 0 || wavefront)
+        {
+            std::cerr << "the closed world traces single rays; ignoring --closed-world\n";
+            use_closed_world = false;
+        }
+        else if (!closed.build(sc, why_not))
+        {
+            std::cerr << "can't close the world (" << why_not << "); tracing through virtual calls\n";
+            use_closed_world = false;
+        }
+    }
+
+    render_settings settings;
+    settings.width = width;
+    settings.height = height;
+    settings.sampling = adaptive;
+    settings.sampling.max_samples = num_samples; //the cap under adaptive sampling
+    settings.path = path;
+    std::unique_ptr<sampler> pixel_sampler = make_sampler(sampler_kind, width, num_samples);
+    settings.source = pixel_sampler.get();
+
+    //everything that changes the image, so checkpoints and workers from some other render aren't mixed in
+    //(field by field where a struct has padding, whose bytes could be anything)
+    int ints[] = { width, height, settings.sampling.enabled, settings.sampling.min_samples,
+                   settings.sampling.max_samples, path.max_depth, path.rr_depth, passes, grid, int(sizeof(vec3)),
+                   sampler_kind, path.light_sampling, lit };
+    float floats[14] = { settings.sampling.threshold, path.rr_min_survival };
+    view.to_floats(floats + 2);
+    uint64_t fingerprint = hash_bytes(ints, sizeof(ints));
+    fingerprint = hash_bytes(floats, sizeof(floats), fingerprint);
+    //the scene's contents rather than its path, so an edited file, or a worker's different copy of it, doesn't match
+    fingerprint = hash_bytes(&scene_hash, sizeof(scene_hash), fingerprint);
+
+    if (coordinator)
+    {
+        //a remote worker: no image of its own, just tiles for the coordinator
+        int fd = connect_to_coordinator(coordinator);
+        if (fd < 0)
+        {
+            std::cerr << "couldn't connect to " << coordinator << "\n";
+            return 1;
+        }
+        return run_worker(fd, sc, cam, settings, fingerprint);
+    }
+
+    //writes the statistics report, if one was asked for; returns main's exit code
+    auto finish_stats = [&]()
+    {
+        if (stats_path)
+        {
+#ifdef RT_STATS
+            if (!write_stats_report(stats_path, path.max_depth))
+            {
+                std::cerr << "couldn't write " << stats_path << "\n";
+                return 1;
+            }
+#else
+            std::cerr << "built without RT_STATS, so there are no statistics to write\n";
+#endif
+        }
+        return 0;
+    };
 
-    //the floor
-    list[0] = new sphere( vec3(0, -1000, 0), 1000, new lambertian(vec3(0.5, 0.5, 0.5)) );
+    render_scheduler scheduler(width, height, tile_size, num_threads); //its threads start on the first run
+    std::vector<uint64_t> samples_spent(scheduler.num_threads, 0);
+    std::vector<uint64_t> rays_traced(scheduler.num_threads, 0);
+    std::vector<wavefront_queues> queues(wavefront ? scheduler.num_threads : 0);
+    if (wavefront && (packet_size != 0 || adaptive.enabled))
+    {
+        std::cerr << "wavefront mode doesn't do packets or adaptive sampling; ignoring them\n";
+        packet_size = 0;
+        settings.sampling.enabled = false;
+    }
+    if (wavefront && std::count(sc.material_types.begin(), sc.material_types.end(), uint8_t(material_light)) > 0)
+    {
+        std::cerr << "wavefront mode doesn't do lights; tracing single rays\n";
+        wavefront = false;
+    }
+    //renders one tile of a frame seen through c into target, whole tiles at a time however it's traced
+    auto trace_tile = [&](const tile& t, int thread_id, const camera& c, framebuffer& target)
+    {
+        if (wavefront)
+        {
+            samples_spent[thread_id] += render_tile_wavefront(t, sc, c, settings, target, queues[thread_id],
+                                                              rays_traced[thread_id]);
+            return;
+        }
 
-    int i = 1;
-    for (int a = -11; a < 11; a++)
+        switch (packet_size)
+        {
+            case 4: samples_spent[thread_id] += render_tile_packets<2, 2>(t, sc, c, settings, target); break;
+            case 8: samples_spent[thread_id] += render_tile_packets<4, 2>(t, sc, c, settings, target); break;
+            case 16: samples_spent[thread_id] += render_tile_packets<4, 4>(t, sc, c, settings, target); break;
+            default:
+                if (use_closed_world)
+                {
+                    samples_spent[thread_id] += render_tile(t, closed, c, settings, target);
+                }
+                else
+                {
+                    samples_spent[thread_id] += render_tile(t, sc, c, settings, target);
+                }
+                break;
+        }
+    };
+
+    if (preview_path)
     {
-        for (int b = -11; b < 11; b++)
+        /* look development: each view's passes go out to the preview file as they finish, coarsest first
+         * each line on stdin is a command, applied once the render threads have dropped the view they were on:
+         *     camera lookfrom 0 2 6 vfov 40    moves the camera; any keys of a scene file's camera line
+         *     reload                           reads the scene file again, camera and all
+         *     quit
+         * the preview ends on quit, or once stdin has closed and the last view has every sample,
+         * which is then written to the output path like any other render
+         */
+        if (num_frames > 0 || num_workers > 0 || listen_port > 0 || passes > 0 || wavefront || packet_size != 0 ||
+            use_closed_world || denoising || write_aov_images)
         {
-            float choose_mat = drand48();
-            vec3 center(a + 0.9*drand48(), 0.2, b + 0.9*drand48());
+            std::cerr << "the preview traces single rays in passes of its own; ignoring --frames, --workers, --listen, "
+                         "--passes, --wavefront, --packet, --closed-world, --denoise and --aovs\n";
+        }
+        preview_output preview(preview_path, width, height);
+        if (!preview.ok())
+        {
+            std::cerr << "couldn't map " << preview_path << "\n";
+            return 1;
+        }
+        preview_commands commands(0);
+        framebuffer fb(width, height);
+        uint32_t view_count = 0;
+        bool finished = false;
+        while (true)
+        {
+            uint64_t seen = commands.changes();
+            accumulation_buffer acc(width, height);
+            auto view_start = std::chrono::steady_clock::now();
+            auto ms_since_start = [&]()
+            {
+                return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - view_start).count();
+            };
+            bool first = true;
+            finished = render_preview(scheduler, sc, cam, settings, 4, acc, fb, preview, view_count,
+                                      [&]() { return commands.changes() != seen; },
+                                      [&](int scale, int samples)
+                                      {
+                                          if (first)
+                                          {
+                                              std::cerr << "preview: view " << view_count << ", first frame in "
+                                                        << ms_since_start() << " ms\n";
+                                              first = false;
+                                          }
+                                      });
+            if (finished)
+            {
+                std::cerr << "preview: view " << view_count << ", " << num_samples << " samples in "
+                          << ms_since_start() << " ms\n";
+            }
+            if (!commands.wait(seen))
+            {
+                break; //stdin closed and nothing left to do
+            }
 
-            //space away from big spheres, I think?
-            if ((center - vec3(4, 0.2, 0)).length() > 0.9) 
+            bool quit = false;
+            std::string command;
+            while (commands.next(command))
             {
-                if (choose_mat < 0.8) //diffuse
+                std::string word = command.substr(0, command.find_first_of(" \t\r\n"));
+                std::string error;
+                if (word == "quit")
                 {
-                    list[i++] = new sphere(center, 0.2, new lambertian( vec3(drand48()*drand48(),
-                                                                             drand48()*drand48(),
-                                                                             drand48()*drand48()) ));
+                    quit = true;
                 }
-                else if (choose_mat < 0.95) //metal
+                else if (word == "camera")
                 {
-                    list[i++] = new sphere( center, 0.2,
-                                            new metal( vec3(0.5*(1 + drand48()), 0.5*(1 + drand48()), 0.5*(1 + drand48())), 0.5*drand48() ) );
+                    scene unused; //the parser only touches the camera for a camera line
+                    if (!parse_scene_text(command.c_str(), command.size(), unused, view, error))
+                    {
+                        std::cerr << "preview: " << error << "\n";
+                    }
                 }
-                else //glass
+                else if (word == "reload" && scene_path)
                 {
-                    list[i++] = new sphere( center, 0.2, new dielectric(1.5) );
+                    //loaded on the side and swapped in, so a scene file saved half-edited doesn't take the current one down
+                    scene trial;
+                    camera_params trial_view;
+                    bool from_cache;
+                    uint64_t trial_hash;
+                    if (!load_scene(scene_path, trial, trial_view, error, from_cache, trial_hash, num_threads))
+                    {
+                        std::cerr << "preview: " << error << "\n";
+                        continue;
+                    }
+                    sc.swap(trial); //trial takes the old scene with it when it goes out of scope
+                    view = trial_view;
+                    sc.build(accel);
                 }
+                else if (!word.empty())
+                {
+                    std::cerr << "preview: unknown command '" << word << "'; try camera, reload (with --scene) or quit\n";
+                }
+            }
+            if (quit)
+            {
+                break;
             }
+            cam = view.make_camera(float(width)/float(height));
+            view_count++;
+        }
+
+        if (!finished)
+        {
+            std::cerr << "preview: the last view wasn't finished, so " << out_path << " isn't written\n";
+            return finish_stats();
         }
+        image_output out(out_path, width, height, format_from_path(out_path), tile_size);
+        if (!out.ok())
+        {
+            std::cerr << "couldn't open " << out_path << "\n";
+            return 1;
+        }
+        out.write_all(fb);
+        if (!out.finish())
+        {
+            std::cerr << "couldn't write " << out_path << "\n";
+            return 1;
+        }
+        return finish_stats();
     }
 
-    //three big spheres
-    list[i++] = new sphere( vec3(0, 1, 0), 1.0, new dielectric(1.5) );
-    list[i++] = new sphere( vec3(-4, 1, 0), 1.0, new lambertian(vec3(0.4, 0.2, 0.1)) );
-    list[i++] = new sphere( vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0) );
+    if (num_frames > 0)
+    {
+        /* a sequence: the scene, its BVH and the render threads stay alive from frame to frame;
+         * each frame poses the animation, refits the BVH to wherever the spheres went, renders,
+         * and hands the finished frame to a writer thread, which writes it while the next one renders
+         */
+        if (num_workers > 0 || listen_port > 0 || passes > 0 || write_aov_images)
+        {
+            std::cerr << "sequences render here in one pass; ignoring --workers, --listen, --passes and --aovs\n";
+        }
+        if (orbit_secs > 0 && anim.moves_camera())
+        {
+            std::cerr << "--orbit and --key both move the camera; use one or the other\n";
+            return 1;
+        }
+        float duration = num_frames / fps;
+        if (orbit_secs > 0)
+        {
+            anim.add_orbit(view, orbit_secs, duration);
+        }
+        if (bounce_height > 0 && anim.add_bounce(sc, bounce_height, duration) == 0)
+        {
+            std::cerr << "nothing to bounce; a compiled scene's spheres can't move\n";
+        }
+
+        auto sequence_start = std::chrono::steady_clock::now();
+        frame_writer frames(out_path, width, height, tile_size);
+        denoise_settings ds;
+        aov_buffers aov(denoising ? width : 0, denoising ? height : 0);
+        double refit_secs = 0, trace_secs = 0, denoise_secs = 0;
+        int rebuilds = 0;
+        for (int f = 0; f < num_frames; f++)
+        {
+            auto frame_start = std::chrono::steady_clock::now();
+            camera_params pose = view;
+            anim.pose(f / fps, pose);
+            if (anim.moves_spheres())
+            {
+                rebuilds += sc.refit(accel);
+                std::string why_not;
+                if (use_closed_world)
+                {
+                    closed.build(sc, why_not); //the spheres it copied have moved, and a rebuild reorders them
+                }
+            }
+            camera frame_cam = pose.make_camera(float(width)/float(height));
+            framebuffer& frame = frames.acquire();
+            if (denoising && frame.variance.empty())
+            {
+                frame.keep_variance();
+            }
 
-    return new hitable_list(list, i);
-}
+            auto trace_start = std::chrono::steady_clock::now();
+            scheduler.run([&](const tile& t, int thread_id) { trace_tile(t, thread_id, frame_cam, frame); });
+            auto trace_end = std::chrono::steady_clock::now();
+            refit_secs += std::chrono::duration<double>(trace_start - frame_start).count();
+            trace_secs += std::chrono::duration<double>(trace_end - trace_start).count();
+            if (denoising)
+            {
+                scheduler.run([&](const tile& t, int thread_id)
+                {
+                    render_tile_aovs(t, sc, frame_cam, settings, std::min(num_samples, ds.aov_samples), aov);
+                });
+                denoise(frame, aov, ds, num_threads);
+                denoise_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - trace_end).count();
+            }
+            frames.submit(frame, f);
+        }
+        bool written = frames.finish();
 
-int main(int argc, char **argv)
-{
-    int width = 200;
-    int height = 100;
-    int num_samples = 100;
+        double total_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - sequence_start).count();
+        uint64_t total_samples = 0;
+        for (size_t k = 0; k < samples_spent.size(); k++)
+        {
+            total_samples += samples_spent[k];
+        }
+        std::cerr << "sequence: " << num_frames << " frames in " << total_secs << " s, "
+                  << total_samples / trace_secs / 1e6 << " M camera rays/s\n";
+        std::cerr << "per frame: " << 1000 * trace_secs / num_frames << " ms tracing, "
+                  << 1000 * refit_secs / num_frames << " ms posing and refitting (" << rebuilds << " rebuilds), "
+                  << 1000 * denoise_secs / num_frames << " ms denoising, "
+                  << 1000 * (total_secs - trace_secs - refit_secs - denoise_secs) / num_frames << " ms anything else\n";
+        for (size_t k = 0; k < frames.failed.size(); k++)
+        {
+            std::cerr << "couldn't write " << frames.failed[k] << "\n";
+        }
+        if (!written)
+        {
+            return 1;
+        }
+        return finish_stats();
+    }
 
-    std::ofstream imgfile;
-    if (argc > 1)
+    bool distributed = num_workers > 0 || listen_port > 0;
+    if (use_closed_world && (distributed || passes > 0))
     {
-        imgfile.open ( argv[1] );
+        std::cerr << "workers and progressive passes trace through virtual calls; ignoring --closed-world\n";
     }
-    else
+    if (distributed && (passes > 0 || wavefront || packet_size != 0))
     {
-        imgfile.open ("ray-trace-out.ppm");
+        std::cerr << "workers render whole tiles with single rays; ignoring --passes, --wavefront and --packet\n";
+        passes = 0;
+        resume = false;
+        wavefront = false;
+        packet_size = 0;
     }
-    imgfile << "P3\n" << width << " " << height << "\n255\n";
+    int listen_fd = -1;
+    if (listen_port > 0 && (listen_fd = listen_for_workers(listen_port)) < 0)
+    {
+        std::cerr << "couldn't listen on port " << listen_port << "\n";
+        return 1;
+    }
+    //forked before any thread starts; each child shares the loaded scene and runs one worker
+    std::vector<int> worker_fds;
+    std::vector<pid_t> worker_pids;
+    spawn_workers(num_workers, [&](int fd) { return run_worker(fd, sc, cam, settings, fingerprint); },
+                  worker_fds, worker_pids);
 
-    vec3 lookfrom(4.2, 2, 3);
-    vec3 lookat(0, 0, -1);
-    float dist_to_focus = (lookat - lookfrom).length();
-    float aperture = 0.1;
-    //         look from, look at, vup          vfov, aspect ratio
-    camera cam(lookfrom, lookat, vec3(0, 1, 0), 90, float(width)/float(height), aperture, dist_to_focus);
+    //the format comes from the extension: .ppm (binary P6), .pfm (float) or .tiles (raw tiled floats)
+    image_output out(out_path, width, height, format_from_path(out_path), tile_size);
+    if (!out.ok())
+    {
+        std::cerr << "couldn't open " << out_path << "\n";
+        return 1;
+    }
 
-    //hitable *list[4];
-    //----------------------version up to ch 9
-    // list[0] = new sphere( vec3(0, 0, -1), 0.5, new lambertian(vec3(0.8, 0.3, 0.3)) );
-    // list[1] = new sphere( vec3(0, -100.5, -1), 100, new lambertian(vec3(0.8, 0.8, 0.0)) ); //basically the floor
-    // list[2] = new sphere( vec3(1, 0, -1), 0.5, new dielectric(1.5) );
-    //list[3] = new sphere( vec3(1, 0, -1), -0.45, new dielectric(1.5) ); //inner sphere for bubble
-    // list[3] = new sphere( vec3(-1, 0, -1), 0.5, new metal(vec3(0.8, 0.8, 0.8), 0.2) );
-    //----------------------version for ch 10 pt 1
-    // float R = cos(M_PI/4.0);
-    // list[0] = new sphere( vec3(-R, 0, -1), R, new lambertian(vec3(0, 0, 1)) );
-    // list[1] = new sphere( vec3(R, 0, -1), R, new lambertian(vec3(1, 0, 0)) );
-    //----------------------
-    //hitable *world = new hitable_list(list, 4);
+    if (resume && passes <= 0)
+    {
+        std::cerr << "--resume needs the same --passes as the render it resumes\n";
+        return 1;
+    }
+    if (passes > 0 && (wavefront || packet_size != 0))
+    {
+        std::cerr << "progressive passes trace single rays; ignoring --wavefront and --packet\n";
+        wavefront = false;
+        packet_size = 0;
+    }
+    std::string checkpoint_file = checkpoint_path ? checkpoint_path : std::string(out_path) + ".checkpoint";
 
-    hitable *world = random_scene();
+    framebuffer fb(width, height);
+    async_tile_writer writer(out, fb); //encodes finished tiles while the rest render
+    if (denoising)
+    {
+        fb.keep_variance(); //the denoiser goes by how noisy each pixel is
+    }
+    //a denoised image can only be written once it's been filtered as a whole, after the render
+    auto tile_done = [&](const tile& t)
+    {
+        if (!denoising)
+        {
+            writer.push(t);
+        }
+    };
+    auto render_start = std::chrono::steady_clock::now();
 
-    for (int j = height - 1; j >= 0; j--)
+    if (passes > 0)
     {
-        for (int i = 0; i < width; i++)
+        accumulation_buffer acc(width, height);
+        int first_pass = 0;
+        if (resume)
         {
-            vec3 col(0, 0, 0);
+            std::string error;
+            if (!load_checkpoint(checkpoint_file.c_str(), fingerprint, acc, first_pass, error))
+            {
+                std::cerr << error << "\n";
+                return 1;
+            }
+            std::cerr << "resuming after pass " << first_pass << " of " << passes << "\n";
+        }
+
+        //each pass takes every pixel pass_samples further; a checkpoint is queued after any pass
+        //that ends checkpoint_secs or more after the last one
+        int pass_samples = (num_samples + passes - 1) / passes;
+        checkpoint_writer checkpoints(checkpoint_file, fingerprint);
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        for (int pass = first_pass; pass < passes; pass++)
+        {
+            int target = std::min(num_samples, (pass + 1) * pass_samples);
+            bool last = pass + 1 == passes;
+            scheduler.run([&](const tile& t, int thread_id)
+            {
+                samples_spent[thread_id] += render_tile_pass(t, sc, cam, settings, acc, target, fb);
+                if (last)
+                {
+                    tile_done(t);
+                }
+            });
 
-            //average colors from samples across pixel
-            for (int s = 0; s < num_samples; s++)
+            auto now = std::chrono::steady_clock::now();
+            if (!last && std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_secs)
+            {
+                checkpoints.save(acc, pass + 1);
+                last_checkpoint = now;
+            }
+        }
+        if (!checkpoints.finish())
+        {
+            std::cerr << "couldn't write checkpoint " << checkpoint_file << "\n";
+        }
+    }
+    else if (distributed)
+    {
+        //results come back as estimates, so merging a tile is just averaging them into the framebuffer
+        tile_coordinator dispatch(width, height, tile_size, fingerprint);
+        accumulation_buffer acc(width, height);
+        auto merge = [&](const tile& t, const pixel_estimate *estimates)
+        {
+            for (int j = t.y0; j < t.y1; j++)
             {
-                float u = float(i + drand48()) / float(width);
-                float v = float(j + drand48()) / float(height);
-                ray r = cam.get_ray(u, v);
-                col += color(r, world, 0);
+                for (int i = t.x0; i < t.x1; i++)
+                {
+                    fb.set(i, j, *estimates++);
+                }
             }
-            col /= float(num_samples);
-            col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) ); //gamma correction
-            
-            int ir = int(255.99 * col[0]);
-            int ig = int(255.99 * col[1]);
-            int ib = int(255.99 * col[2]);
-            
-            imgfile << ir << " " << ig << " " << ib << "\n";
+            tile_done(t);
+        };
+        samples_spent[0] += dispatch.run(worker_fds, listen_fd, merge, [&](const tile& t)
+        {
+            samples_spent[0] += render_tile_pass(t, sc, cam, settings, acc, num_samples, fb);
+            tile_done(t);
+        });
+        for (size_t k = 0; k < worker_pids.size(); k++)
+        {
+            waitpid(worker_pids[k], 0, 0);
+        }
+        if (listen_fd >= 0)
+        {
+            close(listen_fd);
+        }
+        if (dispatch.workers_lost > 0)
+        {
+            std::cerr << dispatch.workers_lost << " workers died; their tiles were rendered again\n";
+        }
+        std::cerr << "tiles: " << dispatch.local_tiles << " here, by worker:";
+        for (size_t k = 0; k < dispatch.worker_tiles.size(); k++)
+        {
+            std::cerr << " " << dispatch.worker_tiles[k];
         }
+        std::cerr << "\n";
+    }
+    else
+    {
+        scheduler.run([&](const tile& t, int thread_id)
+        {
+            trace_tile(t, thread_id, cam, fb);
+            tile_done(t);
+        });
     }
 
-    imgfile.close();
-}
\ No newline at end of file
+    double render_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+    uint64_t total_samples = 0;
+    for (size_t k = 0; k < samples_spent.size(); k++)
+    {
+        total_samples += samples_spent[k];
+    }
+    std::cerr << "render: " << render_secs << " s, "
+              << total_samples / render_secs / 1e6 << " M camera rays/s\n";
+    if (wavefront)
+    {
+        uint64_t total_rays = 0;
+        for (size_t k = 0; k < rays_traced.size(); k++)
+        {
+            total_rays += rays_traced[k];
+        }
+        std::cerr << "wavefront: " << total_rays << " rays, " << total_rays / render_secs / 1e6 << " M rays/s\n";
+    }
+    if (adaptive.enabled)
+    {
+        double budget = double(width) * height * num_samples;
+        std::cerr << "adaptive: " << total_samples << " samples, " << total_samples / (double(width) * height)
+                  << " per pixel on average, " << 100.0 * total_samples / budget << "% of the fixed budget\n";
+    }
+
+    if (denoising || write_aov_images)
+    {
+        //the AOVs come from the first hits of the same camera rays the render traced
+        auto aov_start = std::chrono::steady_clock::now();
+        denoise_settings ds;
+        aov_buffers aov(width, height);
+        scheduler.run([&](const tile& t, int thread_id)
+        {
+            render_tile_aovs(t, sc, cam, settings, std::min(num_samples, ds.aov_samples), aov);
+        });
+        auto denoise_start = std::chrono::steady_clock::now();
+        std::cerr << "aovs: " << std::chrono::duration<double, std::milli>(denoise_start - aov_start).count()
+                  << " ms\n";
+        if (denoising)
+        {
+            denoise(fb, aov, ds, num_threads);
+            out.write_all(fb);
+            std::cerr << "denoise: "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - denoise_start).count()
+                      << " ms\n";
+        }
+        if (write_aov_images && !write_aovs(aov, out_path))
+        {
+            std::cerr << "couldn't write the aovs next to " << out_path << "\n";
+            return 1;
+        }
+    }
+
+    writer.finish();
+    if (!out.finish())
+    {
+        std::cerr << "couldn't write " << out_path << "\n";
+        return 1;
+    }
+    if (passes > 0)
+    {
+        unlink(checkpoint_file.c_str()); //the render is done, nothing left to resume
+    }
+
+    return finish_stats();
+}
@@ -0,0 +1,86 @@
+/* aabb.h
+ * Defines the aabb class, an axis-aligned bounding box
+ * used by the BVH to skip over groups of objects a ray can't hit
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef AABBH
+#define AABBH
+
+#include <float.h>
+#include "ray.h"
+
+class aabb
+{
+    public:
+        //an empty box, which surrounds nothing and grows to fit whatever is added
+        aabb() : _min(FLT_MAX, FLT_MAX, FLT_MAX), _max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+        aabb(const vec3& a, const vec3& b) : _min(a), _max(b) {}
+
+        inline vec3 min() const { return _min; }
+        inline vec3 max() const { return _max; }
+        inline vec3 centroid() const { return vec3::scale(_min + _max, 0.5); }
+
+        //grows the box to also surround b
+        inline void expand(const aabb& b)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                _min[a] = fminf(_min[a], b._min[a]);
+                _max[a] = fmaxf(_max[a], b._max[a]);
+            }
+        }
+
+        inline void expand(const vec3& p)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                _min[a] = fminf(_min[a], p[a]);
+                _max[a] = fmaxf(_max[a], p[a]);
+            }
+        }
+
+        //half the surface area, which is all the SAH needs
+        inline float half_area() const
+        {
+            vec3 d = _max - _min;
+            if (d.x() < 0) return 0; //empty
+            return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+        }
+
+        //slab test; the ray's direction is passed in already inverted
+        inline bool hit(const vec3& origin, const vec3& inv_dir, float t_min, float t_max) const
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                float t0 = (_min[a] - origin[a]) * inv_dir[a];
+                float t1 = (_max[a] - origin[a]) * inv_dir[a];
+                if (inv_dir[a] < 0.0f)
+                {
+                    float tmp = t0; t0 = t1; t1 = tmp;
+                }
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max < t_min)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        vec3 _min;
+        vec3 _max;
+};
+
+//returns the smallest box surrounding both a and b
+aabb surrounding_box(const aabb& a, const aabb& b)
+{
+    aabb box = a;
+    box.expand(b);
+    return box;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/* adaptive_sampling.h
+ * Defines pixel_estimate, a running mean/variance of one pixel's samples,
+ * used to stop sampling a pixel once its error estimate is small enough
+ * flat sky pixels settle after a few samples while glass and fuzzy metal keep going,
+ * so the sample budget ends up where the noise is
+ * the variance is tracked on luminance with Welford's online algorithm
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef ADAPTIVESAMPLINGH
+#define ADAPTIVESAMPLINGH
+
+#include <math.h>
+#include "vec3.h"
+
+struct adaptive_settings
+{
+    bool enabled = false;
+    int min_samples = 16;    //every pixel gets at least this many, so the variance estimate means something
+    int max_samples = 100;
+    float threshold = 0.0075f; //stop once relative_error() drops below this
+};
+
+class pixel_estimate
+{
+    public:
+        pixel_estimate() : sum(0, 0, 0), n(0), mean(0), m2(0) {}
+
+        inline void add(const vec3& c)
+        {
+            sum += c;
+            n++;
+            float y = 0.2126f * c.r() + 0.7152f * c.g() + 0.0722f * c.b();
+            float delta = y - mean;
+            mean += delta / n;
+            m2 += delta * (y - mean);
+        }
+
+        inline vec3 average() const
+        {
+            vec3 avg = sum;
+            if (n > 0)
+            {
+                avg /= float(n);
+            }
+            return avg;
+        }
+
+        //variance of the mean luminance, i.e. how far average() might be off; infinite until there are 2 samples
+        inline float mean_variance() const
+        {
+            if (n < 2)
+            {
+                return INFINITY;
+            }
+            return m2 / (n - 1) / n;
+        }
+
+        /* standard error of the mean luminance, scaled to roughly what it is after gamma
+         * correction (d sqrt(y) = dy / 2 sqrt(y)), so dark pixels aren't held to a tighter bar
+         * than the eye can see; means below 0.01 count as 0.01
+         */
+        inline float relative_error() const
+        {
+            return 0.5f * sqrtf(mean_variance()) / sqrtf(fmaxf(mean, 0.01f));
+        }
+
+        //true once the pixel has all its samples: max_samples, or fewer if adaptive and converged
+        inline bool done(const adaptive_settings& s) const
+        {
+            if (n >= s.max_samples)
+            {
+                return true;
+            }
+            return s.enabled && n >= s.min_samples && relative_error() < s.threshold;
+        }
+
+        vec3 sum;
+        int n;
+        float mean;
+        float m2;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/* animation.h
+ * Keyframed motion for rendering sequences: the camera's lookfrom and lookat, and sphere centers,
+ * each follow a path through keyframes that is sampled at every frame's time
+ * paths are Catmull-Rom splines, so motion through the keys is smooth instead of turning sharp
+ * corners at each one; before the first key and after the last, things hold still
+ * posing the scene only moves the spheres' centers; the caller refits the acceleration structure after
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef ANIMATIONH
+#define ANIMATIONH
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "scene.h"
+#include "scene_file.h"
+#include "sphere.h"
+#include "rng.h"
+
+//a point moving through keyframes
+class motion_path
+{
+    public:
+        //adds a keyframe; keys can come in any order
+        void add(float time, const vec3& p)
+        {
+            size_t k = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+            times.insert(times.begin() + k, time);
+            points.insert(points.begin() + k, p);
+        }
+
+        //where the point is at time t; the path must have at least one key
+        vec3 at(float t) const
+        {
+            size_t n = times.size();
+            if (n == 1 || t <= times[0])
+            {
+                return points[0];
+            }
+            if (t >= times[n - 1])
+            {
+                return points[n - 1];
+            }
+
+            //the segment from key k to k + 1, with the keys on either side shaping its tangents
+            size_t k = std::upper_bound(times.begin(), times.end(), t) - times.begin() - 1;
+            const vec3& p1 = points[k];
+            const vec3& p2 = points[k + 1];
+            const vec3& p0 = k > 0 ? points[k - 1] : p1;
+            const vec3& p3 = k + 2 < n ? points[k + 2] : p2;
+            float dt = times[k + 1] - times[k];
+            float s = (t - times[k]) / dt;
+
+            //Hermite basis, with each tangent the slope between its neighbors, per unit of this segment's time
+            vec3 m1 = vec3::scale(p2 - p0, dt / (times[k + 1] - times[k > 0 ? k - 1 : k]));
+            vec3 m2 = vec3::scale(p3 - p1, dt / (times[k + 2 < n ? k + 2 : k + 1] - times[k]));
+            float s2 = s * s, s3 = s2 * s;
+            return vec3::scale(p1, 2 * s3 - 3 * s2 + 1) + vec3::scale(m1, s3 - 2 * s2 + s) +
+                   vec3::scale(p2, 3 * s2 - 2 * s3) + vec3::scale(m2, s3 - s2);
+        }
+
+        inline bool empty() const { return times.empty(); }
+
+        std::vector<float> times;
+        std::vector<vec3> points;
+};
+
+struct sphere_motion
+{
+    sphere *target;
+    motion_path center;
+};
+
+class animation
+{
+    public:
+        //a camera keyframe: at time, the camera is at lookfrom looking at lookat
+        void add_camera_key(float time, const vec3& from, const vec3& at)
+        {
+            lookfrom.add(time, from);
+            lookat.add(time, at);
+        }
+
+        /* a turntable: the camera circles its lookat about the y axis once every period seconds,
+         * keeping its height, with keys every 1/16 of a turn from time 0 to duration
+         */
+        void add_orbit(const camera_params& view, float period, float duration)
+        {
+            const int keys_per_turn = 16;
+            vec3 offset = view.lookfrom - view.lookat;
+            float radius = sqrtf(offset.x() * offset.x() + offset.z() * offset.z());
+            float start = atan2f(offset.z(), offset.x());
+            int keys = int(ceilf(duration / period * keys_per_turn)) + 1;
+            for (int k = 0; k <= keys; k++)
+            {
+                float time = period * k / keys_per_turn;
+                float angle = start + 2 * float(M_PI) * k / keys_per_turn;
+                add_camera_key(time, view.lookat + vec3(radius * cosf(angle), offset.y(), radius * sinf(angle)),
+                               view.lookat);
+            }
+        }
+
+        /* makes every sphere in sc with a radius of at most max_radius bounce up to height above where it is,
+         * each with its own period and phase, from time 0 to duration
+         * objects that aren't sphere objects (e.g. a compiled scene's mapped spheres) can't move and are skipped;
+         * returns the number of spheres that bounce
+         */
+        int add_bounce(scene& sc, float height, float duration, float max_radius = 0.5f)
+        {
+            const int keys_per_bounce = 8;
+            rng gen(2019); //fixed seed so every run moves the same way
+            int moved = 0;
+            for (size_t k = 0; k < sc.objects.size(); k++)
+            {
+                sphere *s = dynamic_cast<sphere*>(sc.objects[k]);
+                if (!s || fabsf(s->radius) > max_radius)
+                {
+                    continue;
+                }
+
+                float period = 0.6f + 0.6f * gen.next();
+                float phase = gen.next();
+                sphere_motion m = { s, motion_path() };
+                //a parabola from where it is up to height and back, starting phase of the way through;
+                //the keys line up with the bounce so there's always one right where it touches down
+                int keys = int(ceilf((duration / period + phase) * keys_per_bounce)) + 1;
+                for (int i = 0; i <= keys; i++)
+                {
+                    float f = float(i % keys_per_bounce) / keys_per_bounce;
+                    float time = period * (float(i) / keys_per_bounce - phase);
+                    m.center.add(time, s->center + vec3(0, 4 * height * f * (1 - f), 0));
+                }
+                spheres.push_back(m);
+                moved++;
+            }
+            return moved;
+        }
+
+        inline bool moves_camera() const { return !lookfrom.empty(); }
+        inline bool moves_spheres() const { return !spheres.empty(); }
+
+        //poses the scene at time t: moves the animated spheres, and the camera in view if it's keyed
+        void pose(float t, camera_params& view) const
+        {
+            if (moves_camera())
+            {
+                view.lookfrom = lookfrom.at(t);
+                view.lookat = lookat.at(t);
+            }
+            for (size_t k = 0; k < spheres.size(); k++)
+            {
+                spheres[k].target->center = spheres[k].center.at(t);
+            }
+        }
+
+        motion_path lookfrom, lookat;
+        std::vector<sphere_motion> spheres;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/* arena.h
+ * Defines the arena class, a bump allocator that hands out objects from big contiguous blocks
+ * allocating is a pointer bump, objects made one after another sit next to each other in memory,
+ * and everything is freed at once; objects with real destructors get them run on release
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef ARENAH
+#define ARENAH
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class arena
+{
+    public:
+        arena(size_t block = 1 << 16) : block_size(block) {}
+        ~arena() { release(); }
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        //constructs a T in the arena
+        template <typename T, typename... Args>
+        T *make(Args&&... args)
+        {
+            T *obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value)
+            {
+                destructors.push_back(destructor{ obj, [](void *p) { static_cast<T*>(p)->~T(); } });
+            }
+            return obj;
+        }
+
+        //an uninitialized array of n trivially-destructible Ts
+        template <typename T>
+        T *make_array(size_t n)
+        {
+            static_assert(std::is_trivially_destructible<T>::value, "arena arrays don't run destructors");
+            return static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+        }
+
+        void *allocate(size_t size, size_t align)
+        {
+            uintptr_t p = (uintptr_t(cursor) + align - 1) & ~uintptr_t(align - 1);
+            if (cursor == 0 || p + size > uintptr_t(end))
+            {
+                next_block(size + align);
+                p = (uintptr_t(cursor) + align - 1) & ~uintptr_t(align - 1);
+            }
+            cursor = (char*)(p + size);
+            used += size;
+            return (void*)p;
+        }
+
+        /* destroys everything but keeps the blocks, so the next scene built in this arena
+         * doesn't have to go back to the system allocator
+         */
+        void reset()
+        {
+            run_destructors();
+            current = 0;
+            cursor = end = 0;
+            used = 0;
+        }
+
+        //destroys everything and gives the memory back
+        void release()
+        {
+            run_destructors();
+            for (size_t b = 0; b < blocks.size(); b++)
+            {
+                free(blocks[b].start);
+            }
+            blocks.clear();
+            current = 0;
+            cursor = end = 0;
+            used = 0;
+        }
+
+        //trades blocks and objects with other; nothing moves, so pointers into either stay good
+        void swap(arena& other)
+        {
+            std::swap(block_size, other.block_size);
+            blocks.swap(other.blocks);
+            std::swap(current, other.current);
+            std::swap(cursor, other.cursor);
+            std::swap(end, other.end);
+            std::swap(used, other.used);
+            destructors.swap(other.destructors);
+        }
+
+        inline size_t bytes_used() const { return used; }
+
+        size_t bytes_reserved() const
+        {
+            size_t total = 0;
+            for (size_t b = 0; b < blocks.size(); b++)
+            {
+                total += blocks[b].size;
+            }
+            return total;
+        }
+
+    private:
+        struct block
+        {
+            char *start;
+            size_t size;
+        };
+
+        struct destructor
+        {
+            void *obj;
+            void (*destroy)(void*);
+        };
+
+        //moves on to the next kept block that fits, or allocates a new one
+        void next_block(size_t min_size)
+        {
+            while (current < blocks.size())
+            {
+                block& b = blocks[current++];
+                if (b.size >= min_size)
+                {
+                    cursor = b.start;
+                    end = b.start + b.size;
+                    return;
+                }
+            }
+
+            size_t size = min_size > block_size ? min_size : block_size;
+            block b = { (char*)malloc(size), size };
+            if (!b.start)
+            {
+                throw std::bad_alloc();
+            }
+            blocks.push_back(b);
+            current = blocks.size();
+            cursor = b.start;
+            end = b.start + size;
+        }
+
+        void run_destructors()
+        {
+            for (size_t d = destructors.size(); d > 0; d--)
+            {
+                destructors[d - 1].destroy(destructors[d - 1].obj);
+            }
+            destructors.clear();
+        }
+
+        size_t block_size;
+        std::vector<block> blocks;
+        size_t current = 0; //index of the block after the one being filled
+        char *cursor = 0;
+        char *end = 0;
+        size_t used = 0;
+        std::vector<destructor> destructors;
+};
+
+#endif
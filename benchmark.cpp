@@ -0,0 +1,739 @@
+/* benchmark.cpp
+ * Times the hot functions on their own and whole frames of random_scene(),
+ * and writes the results as JSON (ns/op for the small ones, rays/s for frames),
+ * so runs from different commits can be compared
+ * every input comes from a fixed seed, so two runs do exactly the same work
+ * the convergence runs render a small frame with each sampler at a few sample counts and measure
+ * the RMSE against a reference frame with many more samples, whose error is independent of theirs
+ * the denoise runs put a few low sample counts through the denoiser and compare them the same way,
+ * on a bigger frame (the filter needs a few pixels per object) with a reference of a quarter the samples
+ * the closed_ runs repeat the scene intersection, mixed-material scatter and frame timings through a
+ * closed_world, next to the same work through virtual calls
+ * the lights runs render lit_scene(), whose light comes from small lights instead of the sky, with light
+ * sampling on and off at a few sample counts, and measure the RMSE against a light-sampled reference
+ *
+ *     benchmark [--out results.json] [--quick] [--samples N] [--threads N] [--filter text] [--reference N]
+ *     benchmark --verify
+ *
+ * --verify doesn't time anything: it checks the SIMD sphere_batch kernels against sphere::hit (see verify_batches())
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "vec3.h"
+#include "ray.h"
+#include "sphere.h"
+#include "hitable_list.h"
+#include "camera.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "dielectric.h"
+#include "scene.h"
+#include "scenes.h"
+#include "framebuffer.h"
+#include "render_scheduler.h"
+#include "renderer.h"
+#include "denoiser.h"
+#include "closed_world.h"
+#include "rng.h"
+#include "sampler.h"
+
+struct micro_result
+{
+    std::string name;
+    double ns_per_op;
+    uint64_t ops;
+};
+
+struct frame_result
+{
+    std::string name;
+    int width, height, samples;
+    double seconds;
+    double rays_per_sec; //camera rays, i.e. samples
+};
+
+struct convergence_result
+{
+    std::string sampler;
+    int samples;
+    double rmse; //linear radiance, over every channel of every pixel
+    double seconds;
+};
+
+struct lights_result
+{
+    bool light_sampling;
+    int samples;
+    double rmse;
+    double seconds;
+};
+
+struct denoise_result
+{
+    int samples;
+    double rmse_before, rmse_after;
+    double render_seconds;
+    double aov_seconds;     //tracing the first hits for the AOVs
+    double denoise_seconds; //the filter itself
+};
+
+//makes the compiler assume value is read, so the work producing it can't be thrown away
+template <typename T>
+inline void keep(const T& value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+const int pool_size = 1024; //inputs are cycled through a pool this big, so every op sees fresh data
+
+/* checks every sphere_batch kernel this CPU can run against sphere::hit, over the cover scene's spheres:
+ * each of verify_rays random rays has to hit the same sphere through the batches as through a list of
+ * the spheres themselves, at the same t and with the same normal to within verify_tolerance (relative),
+ * or miss in both; prints what it checked and returns the number of kernels that failed
+ */
+const int verify_rays = 200000;
+const float verify_tolerance = 1e-4f;
+
+int verify_batches()
+{
+    rng scene_gen(2019);
+    scene sc;
+    random_scene(sc, scene_gen);
+    std::vector<hitable*> spheres;
+    for (size_t k = 0; k < sc.objects.size(); k++)
+    {
+        if (dynamic_cast<sphere*>(sc.objects[k]))
+        {
+            spheres.push_back(sc.objects[k]);
+        }
+    }
+    hitable_list reference(spheres.data(), int(spheres.size()));
+
+    //from anywhere over the grid, in any direction, so rays cross spheres at every angle, grazing ones included
+    rng gen(4242);
+    std::vector<ray> rays(verify_rays);
+    for (int k = 0; k < verify_rays; k++)
+    {
+        vec3 origin(24 * gen.next() - 12, 3 * gen.next(), 24 * gen.next() - 12);
+        vec3 dir(2 * gen.next() - 1, 2 * gen.next() - 1, 2 * gen.next() - 1);
+        rays[k] = ray(origin, dir);
+    }
+
+    int failed = 0;
+    for (int i = isa_scalar; i < isa_count; i++)
+    {
+        sphere_isa isa = sphere_isa(i);
+        if (!sphere_batch::isa_supported(isa))
+        {
+            printf("%-8s not supported here, skipped\n", sphere_batch::isa_name(isa));
+            continue;
+        }
+
+        arena mem;
+        std::vector<hitable*> batches;
+        batch_spheres(mem, spheres.data(), int(spheres.size()), batches, 16, isa);
+        hitable_list batched(batches.data(), int(batches.size()));
+
+        int hits = 0, mismatches = 0;
+        for (int k = 0; k < verify_rays; k++)
+        {
+            hit_record want, got;
+            bool hit_want = reference.hit(rays[k], 0.001, MAXFLOAT, want);
+            bool hit_got = batched.hit(rays[k], 0.001, MAXFLOAT, got);
+            bool same = hit_want == hit_got;
+            if (same && hit_want)
+            {
+                hits++;
+                same = want.mat_id == got.mat_id && fabsf(got.t - want.t) <= verify_tolerance * fmaxf(1.0f, want.t) &&
+                       (got.normal - want.normal).length() <= verify_tolerance * 10;
+            }
+            if (!same)
+            {
+                mismatches++;
+            }
+        }
+        printf("%-8s %d rays, %d hits, %d mismatches\n", sphere_batch::isa_name(isa), verify_rays, hits, mismatches);
+        failed += mismatches > 0;
+    }
+    return failed;
+}
+
+/* calls op(k) over and over until min_secs have passed, in batches so the clock isn't the bottleneck
+ * k counts up from 0; take k % pool_size to pick inputs
+ */
+template <typename F>
+micro_result run_micro(const char *name, double min_secs, F op)
+{
+    const uint64_t batch = 4096;
+    for (uint64_t k = 0; k < batch; k++)
+    {
+        op(k); //warm up caches and branch predictors
+    }
+
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed;
+    do
+    {
+        for (uint64_t k = 0; k < batch; k++)
+        {
+            op(ops + k);
+        }
+        ops += batch;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < min_secs);
+
+    micro_result result = { name, elapsed * 1e9 / ops, ops };
+    fprintf(stderr, "%-28s %10.2f ns/op\n", name, result.ns_per_op);
+    return result;
+}
+
+//the cover scene's camera for a width x height frame
+camera cover_camera(int width, int height)
+{
+    return camera(vec3(4.2, 2, 3), vec3(0, 0, -1), vec3(0, 1, 0), 90, float(width) / float(height), 0.1,
+                  (vec3(0, 0, -1) - vec3(4.2, 2, 3)).length());
+}
+
+//renders one fixed-seed frame of the cover scene, in world (a scene or a closed_world), and times it
+template <typename W>
+frame_result run_frame(const W& world, const char *prefix, int width, int height, int samples, int num_threads)
+{
+    camera cam = cover_camera(width, height);
+    render_settings settings;
+    settings.width = width;
+    settings.height = height;
+    settings.sampling.max_samples = samples;
+
+    framebuffer fb(width, height);
+    render_scheduler scheduler(width, height, 16, num_threads);
+    auto start = std::chrono::steady_clock::now();
+    scheduler.run([&](const tile& t, int thread_id)
+    {
+        render_tile(t, world, cam, settings, fb);
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    keep(fb.rgb[0]);
+
+    frame_result result;
+    result.name = std::string(prefix) + "_" + std::to_string(width) + "x" + std::to_string(height);
+    result.width = width;
+    result.height = height;
+    result.samples = samples;
+    result.seconds = secs;
+    result.rays_per_sec = double(width) * height * samples / secs;
+    fprintf(stderr, "%-28s %10.3f s, %.3f M rays/s\n", result.name.c_str(), secs, result.rays_per_sec / 1e6);
+    return result;
+}
+
+/* renders sc through the cover camera with samples first_sample to first_sample + samples - 1 of each pixel,
+ * numbers from source; returns the time taken
+ */
+double render_samples(const scene& sc, int first_sample, int samples, const sampler *source, int num_threads,
+                      framebuffer& fb, const path_settings& path = path_settings())
+{
+    camera cam = cover_camera(fb.width, fb.height);
+    render_settings settings;
+    settings.width = fb.width;
+    settings.height = fb.height;
+    settings.path = path;
+    settings.source = source;
+
+    render_scheduler scheduler(fb.width, fb.height, 16, num_threads);
+    auto start = std::chrono::steady_clock::now();
+    scheduler.run([&](const tile& t, int thread_id)
+    {
+        for (int j = t.y0; j < t.y1; j++)
+        {
+            for (int i = t.x0; i < t.x1; i++)
+            {
+                pixel_estimate est;
+                for (int s = 0; s < samples; s++)
+                {
+                    est.add(sample_pixel(i, j, first_sample + s, sc, cam, settings));
+                }
+                fb.set(i, j, est);
+            }
+        }
+    });
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double rmse(const framebuffer& a, const framebuffer& b)
+{
+    double sum = 0;
+    for (size_t k = 0; k < a.rgb.size(); k++)
+    {
+        double d = double(a.rgb[k]) - double(b.rgb[k]);
+        sum += d * d;
+    }
+    return sqrt(sum / a.rgb.size());
+}
+
+bool write_json(FILE *f, const std::vector<micro_result>& micro, const std::vector<frame_result>& frames,
+                const std::vector<convergence_result>& convergence, const std::vector<lights_result>& lit,
+                const std::vector<denoise_result>& denoised, int reference_samples, int samples, int num_threads)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(f, "  \"vec3\": \"%s\",\n", VEC3_BACKEND);
+    fprintf(f, "  \"threads\": %d,\n", num_threads);
+    fprintf(f, "  \"samples\": %d,\n", samples);
+    fprintf(f, "  \"micro\": [\n");
+    for (size_t k = 0; k < micro.size(); k++)
+    {
+        fprintf(f, "    { \"name\": \"%s\", \"ns_per_op\": %.4f, \"ops\": %llu }%s\n", micro[k].name.c_str(),
+                micro[k].ns_per_op, (unsigned long long)micro[k].ops, k + 1 < micro.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"frames\": [\n");
+    for (size_t k = 0; k < frames.size(); k++)
+    {
+        const frame_result& r = frames[k];
+        fprintf(f, "    { \"name\": \"%s\", \"width\": %d, \"height\": %d, \"samples\": %d, "
+                   "\"seconds\": %.6f, \"rays_per_sec\": %.1f }%s\n",
+                r.name.c_str(), r.width, r.height, r.samples, r.seconds, r.rays_per_sec,
+                k + 1 < frames.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"reference_samples\": %d,\n", reference_samples);
+    fprintf(f, "  \"convergence\": [\n");
+    for (size_t k = 0; k < convergence.size(); k++)
+    {
+        const convergence_result& r = convergence[k];
+        fprintf(f, "    { \"sampler\": \"%s\", \"samples\": %d, \"rmse\": %.6f, \"seconds\": %.6f }%s\n",
+                r.sampler.c_str(), r.samples, r.rmse, r.seconds, k + 1 < convergence.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"lights\": [\n");
+    for (size_t k = 0; k < lit.size(); k++)
+    {
+        const lights_result& r = lit[k];
+        fprintf(f, "    { \"light_sampling\": %s, \"samples\": %d, \"rmse\": %.6f, \"seconds\": %.6f }%s\n",
+                r.light_sampling ? "true" : "false", r.samples, r.rmse, r.seconds, k + 1 < lit.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"denoise\": [\n");
+    for (size_t k = 0; k < denoised.size(); k++)
+    {
+        const denoise_result& r = denoised[k];
+        fprintf(f, "    { \"samples\": %d, \"rmse_before\": %.6f, \"rmse_after\": %.6f, \"render_seconds\": %.6f, "
+                   "\"aov_seconds\": %.6f, \"denoise_seconds\": %.6f }%s\n",
+                r.samples, r.rmse_before, r.rmse_after, r.render_seconds, r.aov_seconds, r.denoise_seconds,
+                k + 1 < denoised.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+    return ferror(f) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = 0; //0 = stdout
+    double min_secs = 0.5;
+    bool quick = false;
+    int samples = 16;
+    int num_threads = 0;
+    const char *filter = "";
+    int reference_samples = 0; //0 picks by --quick
+    bool verify = false;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "--out") == 0 && a + 1 < argc)
+        {
+            out_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--quick") == 0)
+        {
+            quick = true;
+            min_secs = 0.05;
+        }
+        else if (strcmp(argv[a], "--samples") == 0 && a + 1 < argc)
+        {
+            samples = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+        {
+            num_threads = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--filter") == 0 && a + 1 < argc)
+        {
+            filter = argv[++a];
+        }
+        else if (strcmp(argv[a], "--reference") == 0 && a + 1 < argc)
+        {
+            reference_samples = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--verify") == 0)
+        {
+            verify = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--out file.json] [--quick] [--samples N] [--threads N] [--filter text] "
+                            "[--reference N] [--verify]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (verify)
+    {
+        return verify_batches() == 0 ? 0 : 1;
+    }
+    auto wanted = [&](const char *name) { return strstr(name, filter) != 0; };
+
+    //----------------------inputs, all from fixed seeds
+    rng gen(12345);
+    auto random_vec = [&]() { return vec3(2 * gen.next() - 1, 2 * gen.next() - 1, 2 * gen.next() - 1); };
+
+    std::vector<vec3> va(pool_size), vb(pool_size);
+    for (int k = 0; k < pool_size; k++)
+    {
+        va[k] = random_vec();
+        vb[k] = random_vec();
+    }
+
+    //rays from around the origin toward a unit sphere at (0, 0, -3), about half of them hitting
+    sphere ball(vec3(0, 0, -3), 1, 0);
+    std::vector<ray> sphere_rays(pool_size);
+    for (int k = 0; k < pool_size; k++)
+    {
+        vec3 target = ball.center + vec3::scale(random_vec(), 1.4);
+        vec3 origin = vec3::scale(random_vec(), 0.1);
+        sphere_rays[k] = ray(origin, target - origin);
+    }
+
+    rng scene_gen(2019);
+    scene sc;
+    random_scene(sc, scene_gen);
+    accel_settings accel;
+    accel.use_bvh = false;
+    sc.build(accel);
+
+    //camera rays through the cover scene, and the hits they make, as inputs for the scatter functions
+    camera cam(vec3(4.2, 2, 3), vec3(0, 0, -1), vec3(0, 1, 0), 90, 2.0, 0.1, (vec3(0, 0, -1) - vec3(4.2, 2, 3)).length());
+    std::vector<ray> scene_rays(pool_size);
+    std::vector<hit_record> scene_hits;
+    std::vector<ray> hit_rays;
+    for (int k = 0; k < pool_size; k++)
+    {
+        scene_rays[k] = cam.get_ray(gen.next(), gen.next(), gen);
+    }
+    for (int k = 0; hit_rays.size() < pool_size; k++)
+    {
+        ray r = cam.get_ray(gen.next(), gen.next() * 0.5f, gen); //lower half, mostly spheres and floor
+        hit_record rec;
+        if (sc.world->hit(r, 0.001, MAXFLOAT, rec))
+        {
+            scene_hits.push_back(rec);
+            hit_rays.push_back(r);
+        }
+    }
+
+    lambertian diffuse(vec3(0.5, 0.5, 0.5));
+    metal shiny(vec3(0.7, 0.6, 0.5), 0.3);
+    dielectric glass(1.5);
+
+    //----------------------microbenchmarks
+    std::vector<micro_result> micro;
+    const int mask = pool_size - 1;
+
+    if (wanted("vec3_dot"))
+    {
+        micro.push_back(run_micro("vec3_dot", min_secs, [&](uint64_t k)
+        {
+            float d = vec3::dot(va[k & mask], vb[k & mask]);
+            keep(d);
+        }));
+    }
+    if (wanted("vec3_cross"))
+    {
+        micro.push_back(run_micro("vec3_cross", min_secs, [&](uint64_t k)
+        {
+            vec3 c = vec3::cross(va[k & mask], vb[k & mask]);
+            keep(c);
+        }));
+    }
+    if (wanted("vec3_unit_vector"))
+    {
+        micro.push_back(run_micro("vec3_unit_vector", min_secs, [&](uint64_t k)
+        {
+            vec3 u = vec3::unit_vector(va[k & mask]);
+            keep(u);
+        }));
+    }
+    if (wanted("vec3_reflect"))
+    {
+        micro.push_back(run_micro("vec3_reflect", min_secs, [&](uint64_t k)
+        {
+            vec3 r = vec3::reflect(va[k & mask], vb[k & mask]);
+            keep(r);
+        }));
+    }
+    if (wanted("vec3_mul_add"))
+    {
+        micro.push_back(run_micro("vec3_mul_add", min_secs, [&](uint64_t k)
+        {
+            vec3 m = va[k & mask] * vb[k & mask] + vec3::scale(va[(k + 1) & mask], 0.5f);
+            keep(m);
+        }));
+    }
+    if (wanted("sphere_hit"))
+    {
+        micro.push_back(run_micro("sphere_hit", min_secs, [&](uint64_t k)
+        {
+            hit_record rec;
+            bool h = ball.hit(sphere_rays[k & mask], 0.001, MAXFLOAT, rec);
+            keep(h);
+            keep(rec);
+        }));
+    }
+    if (wanted("hitable_list_hit"))
+    {
+        micro.push_back(run_micro("hitable_list_hit", min_secs / 4, [&](uint64_t k)
+        {
+            hit_record rec;
+            bool h = sc.list->hit(scene_rays[k & mask], 0.001, MAXFLOAT, rec);
+            keep(h);
+            keep(rec);
+        }));
+    }
+    const material *materials[3] = { &diffuse, &shiny, &glass };
+    const char *scatter_names[3] = { "lambertian_scatter", "metal_scatter", "dielectric_scatter" };
+    for (int m = 0; m < 3; m++)
+    {
+        if (!wanted(scatter_names[m]))
+        {
+            continue;
+        }
+        const material *mat = materials[m];
+        micro.push_back(run_micro(scatter_names[m], min_secs, [&](uint64_t k)
+        {
+            vec3 attenuation;
+            ray scattered;
+            bool s = mat->scatter(hit_rays[k & mask], scene_hits[k & mask], attenuation, scattered, gen);
+            keep(s);
+            keep(scattered);
+        }));
+    }
+    if (wanted("camera_get_ray"))
+    {
+        micro.push_back(run_micro("camera_get_ray", min_secs, [&](uint64_t k)
+        {
+            const vec3& uv = va[k & mask];
+            ray r = cam.get_ray(0.5f + 0.5f * uv.x(), 0.5f + 0.5f * uv.y(), gen);
+            keep(r);
+        }));
+    }
+
+    //----------------------full frames of the cover scene, through the BVH like a normal render
+    std::vector<frame_result> frames;
+    accel.use_bvh = true;
+    accel.num_threads = num_threads;
+    sc.build(accel);
+    const int sizes[3][2] = { { 200, 100 }, { 400, 200 }, { 800, 400 } };
+    for (int s = 0; s < (quick ? 1 : 3); s++)
+    {
+        std::string name = "frame_" + std::to_string(sizes[s][0]) + "x" + std::to_string(sizes[s][1]);
+        if (wanted(name.c_str()))
+        {
+            frames.push_back(run_frame(sc, "frame", sizes[s][0], sizes[s][1], samples, num_threads));
+        }
+    }
+
+    //----------------------the same work through a closed world, without virtual calls
+    closed_world closed;
+    std::string why_not;
+    if (!closed.build(sc, why_not))
+    {
+        fprintf(stderr, "can't close the cover scene: %s\n", why_not.c_str());
+        return 1;
+    }
+    if (wanted("scene_hit_virtual"))
+    {
+        micro.push_back(run_micro("scene_hit_virtual", min_secs, [&](uint64_t k)
+        {
+            hit_record rec;
+            bool h = sc.world->hit(scene_rays[k & mask], 0.001, MAXFLOAT, rec);
+            keep(h);
+            keep(rec);
+        }));
+    }
+    if (wanted("scene_hit_closed"))
+    {
+        micro.push_back(run_micro("scene_hit_closed", min_secs, [&](uint64_t k)
+        {
+            hit_record rec;
+            bool h = closed.hit(scene_rays[k & mask], 0.001, MAXFLOAT, rec);
+            keep(h);
+            keep(rec);
+        }));
+    }
+    //the hits' own materials, so the type changes unpredictably from one call to the next like it does in a render
+    if (wanted("scatter_mixed_virtual"))
+    {
+        micro.push_back(run_micro("scatter_mixed_virtual", min_secs, [&](uint64_t k)
+        {
+            vec3 attenuation;
+            ray scattered;
+            const hit_record& rec = scene_hits[k & mask];
+            bool s = sc.get_material(rec.mat_id)->scatter(hit_rays[k & mask], rec, attenuation, scattered, gen);
+            keep(s);
+            keep(scattered);
+        }));
+    }
+    if (wanted("scatter_mixed_closed"))
+    {
+        micro.push_back(run_micro("scatter_mixed_closed", min_secs, [&](uint64_t k)
+        {
+            vec3 attenuation;
+            ray scattered;
+            bool s = closed.scatter(hit_rays[k & mask], scene_hits[k & mask], attenuation, scattered, gen);
+            keep(s);
+            keep(scattered);
+        }));
+    }
+    for (int s = 0; s < (quick ? 1 : 3); s++)
+    {
+        std::string name = "frame_closed_" + std::to_string(sizes[s][0]) + "x" + std::to_string(sizes[s][1]);
+        if (wanted(name.c_str()))
+        {
+            frames.push_back(run_frame(closed, "frame_closed", sizes[s][0], sizes[s][1], samples, num_threads));
+        }
+    }
+
+    //----------------------convergence of each sampler on a small frame
+    std::vector<convergence_result> convergence;
+    if (reference_samples <= 0)
+    {
+        reference_samples = quick ? 1024 : 4096;
+    }
+    if (wanted("convergence"))
+    {
+        const int width = 100, height = 50;
+        //scrambled Sobol converges fastest; a seed of its own keeps its error independent of the sobol runs'
+        framebuffer reference(width, height);
+        sobol_sampler reference_source(1);
+        double secs = render_samples(sc, 0, reference_samples, &reference_source, num_threads, reference);
+        fprintf(stderr, "%-28s %10.3f s\n", "convergence_reference", secs);
+
+        const int counts[] = { 4, 16, 64, 256 };
+        for (int t = 0; t < sampler_type_count; t++)
+        {
+            for (int c = 0; c < (quick ? 3 : 4); c++)
+            {
+                framebuffer fb(width, height);
+                std::unique_ptr<sampler> source = make_sampler(sampler_type(t), width, counts[c]);
+                convergence_result r;
+                r.sampler = sampler_names[t];
+                r.samples = counts[c];
+                r.seconds = render_samples(sc, 0, counts[c], source.get(), num_threads, fb);
+                r.rmse = rmse(fb, reference);
+                convergence.push_back(r);
+                std::string name = "convergence_" + r.sampler + "_" + std::to_string(r.samples);
+                fprintf(stderr, "%-28s %10.5f rmse, %.3f s\n", name.c_str(), r.rmse, r.seconds);
+            }
+        }
+    }
+
+    //----------------------light sampling on a scene lit by small lights
+    std::vector<lights_result> lit;
+    if (wanted("lights"))
+    {
+        scene lit_sc;
+        rng lit_gen(2019);
+        lit_scene(lit_sc, lit_gen);
+        lit_sc.build(accel);
+
+        //the reference starts past the samples the runs take, so its error is independent of theirs
+        const int width = 100, height = 50;
+        const int counts[] = { 4, 16, 64, 256 };
+        framebuffer reference(width, height);
+        double secs = render_samples(lit_sc, counts[3], reference_samples, 0, num_threads, reference);
+        fprintf(stderr, "%-28s %10.3f s\n", "lights_reference", secs);
+
+        for (int on = 1; on >= 0; on--)
+        {
+            path_settings path;
+            path.light_sampling = on;
+            for (int c = 0; c < (quick ? 3 : 4); c++)
+            {
+                framebuffer fb(width, height);
+                lights_result r;
+                r.light_sampling = on;
+                r.samples = counts[c];
+                r.seconds = render_samples(lit_sc, 0, counts[c], 0, num_threads, fb, path);
+                r.rmse = rmse(fb, reference);
+                lit.push_back(r);
+                std::string name = std::string("lights_") + (on ? "on_" : "off_") + std::to_string(r.samples);
+                fprintf(stderr, "%-28s %10.5f rmse, %.3f s\n", name.c_str(), r.rmse, r.seconds);
+            }
+        }
+    }
+
+    //----------------------low sample counts through the denoiser
+    std::vector<denoise_result> denoised;
+    if (wanted("denoise"))
+    {
+        const int width = 400, height = 200;
+        framebuffer reference(width, height);
+        sobol_sampler reference_source(1);
+        double secs = render_samples(sc, 0, reference_samples / 4, &reference_source, num_threads, reference);
+        fprintf(stderr, "%-28s %10.3f s\n", "denoise_reference", secs);
+
+        camera cam = cover_camera(width, height);
+        render_settings settings;
+        settings.width = width;
+        settings.height = height;
+        denoise_settings ds;
+        render_scheduler scheduler(width, height, 16, num_threads);
+
+        const int counts[] = { 4, 8, 16, 32 };
+        for (int c = 0; c < (quick ? 3 : 4); c++)
+        {
+            denoise_result r;
+            r.samples = counts[c];
+            framebuffer fb(width, height);
+            fb.keep_variance();
+            r.render_seconds = render_samples(sc, 0, counts[c], 0, num_threads, fb);
+            r.rmse_before = rmse(fb, reference);
+
+            aov_buffers aov(width, height);
+            auto start = std::chrono::steady_clock::now();
+            scheduler.run([&](const tile& t, int thread_id)
+            {
+                render_tile_aovs(t, sc, cam, settings, std::min(counts[c], ds.aov_samples), aov);
+            });
+            auto traced = std::chrono::steady_clock::now();
+            denoise(fb, aov, ds, num_threads);
+            auto filtered = std::chrono::steady_clock::now();
+            r.aov_seconds = std::chrono::duration<double>(traced - start).count();
+            r.denoise_seconds = std::chrono::duration<double>(filtered - traced).count();
+            r.rmse_after = rmse(fb, reference);
+            denoised.push_back(r);
+            std::string name = "denoise_" + std::to_string(r.samples);
+            fprintf(stderr, "%-28s %10.5f -> %.5f rmse, %.3f s render, %.3f s aovs, %.3f s filter\n", name.c_str(),
+                    r.rmse_before, r.rmse_after, r.render_seconds, r.aov_seconds, r.denoise_seconds);
+        }
+    }
+
+    int threads_used = render_scheduler(1, 1, 1, num_threads).num_threads;
+    FILE *f = out_path ? fopen(out_path, "w") : stdout;
+    if (!f || !write_json(f, micro, frames, convergence, lit, denoised, reference_samples, samples, threads_used) ||
+        (out_path && fclose(f) != 0))
+    {
+        fprintf(stderr, "couldn't write %s\n", out_path ? out_path : "stdout");
+        return 1;
+    }
+}
@@ -0,0 +1,151 @@
+/* blue_noise.h
+ * Defines blue_noise_mask, a 64x64 tile of thresholds whose values are spread out like blue noise:
+ * pixels with close values are far apart, so offsetting each pixel's samples by its threshold
+ * turns the leftover error into fine high-frequency grain instead of blotches
+ * made once at startup with Ulichney's void-and-cluster method ("The void-and-cluster method
+ * for dither array generation", 1993); the tile wraps around, so it can be repeated across the image
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef BLUENOISEH
+#define BLUENOISEH
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+class blue_noise_mask
+{
+    public:
+        static const int size = 64; //a power of two, so wrapping is a mask
+
+        blue_noise_mask() : value(size * size)
+        {
+            const int n = size * size;
+
+            //how much a set pixel adds to the energy of each pixel around it, by offset, wrapping around the edges
+            std::vector<float> kernel(n);
+            for (int dy = 0; dy < size; dy++)
+            {
+                for (int dx = 0; dx < size; dx++)
+                {
+                    int x = dx < size / 2 ? dx : size - dx;
+                    int y = dy < size / 2 ? dy : size - dy;
+                    kernel[dy * size + dx] = expf(-float(x * x + y * y) / (2 * sigma * sigma));
+                }
+            }
+
+            std::vector<uint8_t> pattern(n, 0);
+            std::vector<float> energy(n, 0.0f);
+            auto toggle = [&](int p, bool on)
+            {
+                pattern[p] = on;
+                int px = p % size, py = p / size;
+                float sign = on ? 1.0f : -1.0f;
+                for (int y = 0; y < size; y++)
+                {
+                    const float *row = &kernel[((y - py) & (size - 1)) * size];
+                    for (int x = 0; x < size; x++)
+                    {
+                        energy[y * size + x] += sign * row[(x - px) & (size - 1)];
+                    }
+                }
+            };
+            //the set pixel with the most energy, or the empty one with the least
+            auto tightest_cluster = [&]()
+            {
+                int best = -1;
+                for (int p = 0; p < n; p++)
+                {
+                    if (pattern[p] && (best < 0 || energy[p] > energy[best]))
+                    {
+                        best = p;
+                    }
+                }
+                return best;
+            };
+            auto largest_void = [&]()
+            {
+                int best = -1;
+                for (int p = 0; p < n; p++)
+                {
+                    if (!pattern[p] && (best < 0 || energy[p] < energy[best]))
+                    {
+                        best = p;
+                    }
+                }
+                return best;
+            };
+
+            //a sparse random starting pattern, from a fixed seed so every run gets the same mask
+            const int initial = n / 10;
+            uint32_t state = 2019;
+            for (int placed = 0; placed < initial; )
+            {
+                state = state * 1664525u + 1013904223u;
+                int p = int(state >> 20) % n;
+                if (!pattern[p])
+                {
+                    toggle(p, true);
+                    placed++;
+                }
+            }
+
+            //even it out: move the tightest cluster into the largest void until that's where it came from
+            //(capped, in case it ever ends up cycling between a few swaps)
+            for (int swaps = 0; swaps < n; swaps++)
+            {
+                int cluster = tightest_cluster();
+                toggle(cluster, false);
+                int hole = largest_void();
+                toggle(hole, true);
+                if (hole == cluster)
+                {
+                    break;
+                }
+            }
+
+            /* rank every pixel: the starting pattern's pixels by taking out tightest clusters one at a time,
+             * the rest by filling largest voids one at a time
+             * (the original method switches to clusters of empty pixels past half full; filling voids
+             * all the way up is simpler and looks about the same)
+             */
+            std::vector<int> rank(n);
+            std::vector<uint8_t> start_pattern = pattern;
+            std::vector<float> start_energy = energy;
+            for (int r = initial - 1; r >= 0; r--)
+            {
+                int cluster = tightest_cluster();
+                toggle(cluster, false);
+                rank[cluster] = r;
+            }
+            pattern = start_pattern;
+            energy = start_energy;
+            for (int r = initial; r < n; r++)
+            {
+                int hole = largest_void();
+                toggle(hole, true);
+                rank[hole] = r;
+            }
+
+            for (int p = 0; p < n; p++)
+            {
+                value[p] = (rank[p] + 0.5f) / n;
+            }
+        }
+
+        //threshold in (0, 1) at pixel (x, y), repeating the tile in both directions
+        inline float at(uint32_t x, uint32_t y) const
+        {
+            return value[(y & (size - 1)) * size + (x & (size - 1))];
+        }
+
+    private:
+        static constexpr float sigma = 1.5f; //width of the energy kernel, in pixels
+
+        std::vector<float> value;
+};
+
+#endif
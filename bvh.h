@@ -0,0 +1,624 @@
+/* bvh.h
+ * Defines the bvh class, a bounding volume hierarchy over a set of hitables
+ * that replaces testing every object in a hitable_list with a walk down a tree of boxes
+ * the tree is built with the binned surface area heuristic (SAH), then flattened into
+ * one array of nodes in depth-first order so a walk touches memory mostly front to back
+ * bvh_tree only knows about boxes, so anything that can give a box per primitive can use it
+ * see Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies" (2007)
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef BVHH
+#define BVHH
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "hitable.h"
+#include "ray_packet.h"
+#include "stats.h"
+
+//one node of the flattened tree, 32 bytes so two fit in a cache line
+struct bvh_node
+{
+    float bmin[3];
+    float bmax[3];
+    uint32_t offset; //interior: index of the second child (the first follows directly); leaf: first primitive
+    uint16_t count;  //number of primitives in a leaf, 0 for interior nodes
+    uint16_t axis;   //axis the node was split on, used to visit the nearer child first
+};
+
+class bvh_tree
+{
+    public:
+        /* builds the tree over the given primitive boxes
+         * afterwards prim_order[k] is the index of the k-th primitive in leaf order
+         * subtrees bigger than parallel_threshold are built on their own thread,
+         * up to num_threads at a time (0 = every hardware thread)
+         */
+        void build(const std::vector<aabb>& boxes, int num_threads = 0)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            nodes.clear();
+            prim_order.resize(boxes.size());
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                prim_order[i] = uint32_t(i);
+            }
+
+            if (!boxes.empty())
+            {
+                if (num_threads <= 0)
+                {
+                    num_threads = std::thread::hardware_concurrency();
+                }
+                spare_threads = num_threads - 1;
+
+                std::vector<vec3> centroids(boxes.size());
+                for (size_t i = 0; i < boxes.size(); i++)
+                {
+                    centroids[i] = boxes[i].centroid();
+                }
+
+                int node_count = 0;
+                std::unique_ptr<build_node> root = build_range(boxes, centroids, 0, uint32_t(boxes.size()), 0, node_count);
+                nodes.reserve(node_count);
+                flatten(root.get());
+            }
+            built_area.resize(nodes.size());
+            for (size_t k = 0; k < nodes.size(); k++)
+            {
+                built_area[k] = node_box(nodes[k]).half_area();
+            }
+
+            build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        /* moves every node's box to fit primitives that have moved, keeping the tree as it was built
+         * leaf_boxes[k] is the new box of the k-th primitive in leaf order (prim_order[k])
+         * far cheaper than a rebuild, but the tree gets worse the further things move from where it was built
+         */
+        void refit(const aabb *leaf_boxes)
+        {
+            //children always come after their parent, so going backwards reaches both before the node itself
+            for (size_t k = nodes.size(); k-- > 0; )
+            {
+                bvh_node& n = nodes[k];
+                aabb box;
+                if (n.count > 0)
+                {
+                    for (uint32_t i = n.offset; i < n.offset + n.count; i++)
+                    {
+                        box.expand(leaf_boxes[i]);
+                    }
+                }
+                else
+                {
+                    box = node_box(nodes[k + 1]);
+                    box.expand(node_box(nodes[n.offset]));
+                }
+                for (int a = 0; a < 3; a++)
+                {
+                    n.bmin[a] = box.min()[a];
+                    n.bmax[a] = box.max()[a];
+                }
+            }
+        }
+
+        /* how much refits have worn the tree down: the average over nodes of how many times bigger
+         * (by area, so by the odds of a ray reaching it) each node is than when it was built
+         * things moving together just move their boxes, so it's things moving apart that raise it
+         * (averaged per node rather than summed by SAH, where a huge floor sphere near the root would drown out the rest)
+         */
+        float refit_growth() const
+        {
+            double growth = 0;
+            for (size_t k = 0; k < nodes.size(); k++)
+            {
+                growth += node_box(nodes[k]).half_area() / fmaxf(built_area[k], 1e-12f);
+            }
+            return nodes.empty() ? 1 : float(growth / nodes.size());
+        }
+
+        /* walks the tree, calling hit_leaf(first, count, t_max) for every leaf the ray reaches
+         * hit_leaf returns whether it found a hit and shrinks t_max to the closest one,
+         * which lets later boxes get culled
+         */
+        template <typename F>
+        bool traverse(const ray& r, float t_min, float& t_max, F hit_leaf) const
+        {
+            if (nodes.empty())
+            {
+                return false;
+            }
+            return traverse_nodes(nodes.data(), r, t_min, t_max, hit_leaf);
+        }
+
+        /* walks the tree until hit_leaf(first, count, t_max) finds any hit at all, for shadow rays;
+         * returns whether one did, without looking for anything closer
+         */
+        template <typename F>
+        bool traverse_any(const ray& r, float t_min, float t_max, F hit_leaf) const
+        {
+            if (nodes.empty())
+            {
+                return false;
+            }
+            return traverse_nodes<true>(nodes.data(), r, t_min, t_max, hit_leaf);
+        }
+
+        /* traverse over a flattened tree stored somewhere else, e.g. a memory-mapped scene file
+         * nodes must hold at least one node; with any_hit, it stops at the first leaf that finds a hit
+         */
+        template <bool any_hit = false, typename F>
+        static bool traverse_nodes(const bvh_node *nodes, const ray& r, float t_min, float& t_max, F hit_leaf)
+        {
+
+            vec3 origin = r.origin();
+            vec3 dir = r.direction();
+            float inv_dir[3] = { float(1.0f / dir[0]), float(1.0f / dir[1]), float(1.0f / dir[2]) };
+            float org[3] = { float(origin[0]), float(origin[1]), float(origin[2]) };
+
+            uint32_t stack[64];
+            int sp = 0;
+            uint32_t current = 0;
+            bool hit_anything = false;
+
+            while (true)
+            {
+                const bvh_node& node = nodes[current];
+                STATS_COUNT(stat_bvh_nodes);
+                if (node_hit(node, org, inv_dir, t_min, t_max))
+                {
+                    if (node.count > 0)
+                    {
+                        if (hit_leaf(node.offset, node.count, t_max))
+                        {
+                            if (any_hit)
+                            {
+                                return true;
+                            }
+                            hit_anything = true;
+                        }
+                    }
+                    else
+                    {
+                        //go to the child nearer the ray origin first, save the other for later
+                        if (inv_dir[node.axis] < 0)
+                        {
+                            stack[sp++] = current + 1;
+                            current = node.offset;
+                        }
+                        else
+                        {
+                            stack[sp++] = node.offset;
+                            current = current + 1;
+                        }
+                        continue;
+                    }
+                }
+
+                if (sp == 0)
+                {
+                    break;
+                }
+                current = stack[--sp];
+            }
+
+            return hit_anything;
+        }
+
+        /* packet version of traverse: walks the tree once for all active lanes of p
+         * calls hit_leaf(first, count, lanes) with the mask of lanes whose ray reached the leaf;
+         * hit_leaf shrinks t_max[l] for each lane it finds a hit for
+         * children are ordered by the direction of the first active lane
+         */
+        template <int N, typename F>
+        void traverse_packet(const ray_packet<N>& p, float t_min, float *t_max, F hit_leaf) const
+        {
+            if (nodes.empty() || p.active == 0)
+            {
+                return;
+            }
+
+            float inv_x[N], inv_y[N], inv_z[N];
+            for (int l = 0; l < N; l++)
+            {
+                inv_x[l] = 1.0f / p.dx[l];
+                inv_y[l] = 1.0f / p.dy[l];
+                inv_z[l] = 1.0f / p.dz[l];
+            }
+            int lead = __builtin_ctz(p.active);
+            float lead_inv[3] = { inv_x[lead], inv_y[lead], inv_z[lead] };
+
+            uint32_t stack[64];
+            int sp = 0;
+            uint32_t current = 0;
+
+            while (true)
+            {
+                const bvh_node& node = nodes[current];
+
+                //slab test for every lane at once; written as plain loops so they vectorize
+                int reached[N];
+                for (int l = 0; l < N; l++)
+                {
+                    float t0 = (node.bmin[0] - p.ox[l]) * inv_x[l], t1 = (node.bmax[0] - p.ox[l]) * inv_x[l];
+                    float lo = max_f(t_min, min_f(t0, t1)), hi = min_f(t_max[l], max_f(t0, t1));
+                    t0 = (node.bmin[1] - p.oy[l]) * inv_y[l]; t1 = (node.bmax[1] - p.oy[l]) * inv_y[l];
+                    lo = max_f(lo, min_f(t0, t1)); hi = min_f(hi, max_f(t0, t1));
+                    t0 = (node.bmin[2] - p.oz[l]) * inv_z[l]; t1 = (node.bmax[2] - p.oz[l]) * inv_z[l];
+                    lo = max_f(lo, min_f(t0, t1)); hi = min_f(hi, max_f(t0, t1));
+                    reached[l] = lo <= hi;
+                }
+                uint32_t lanes = 0;
+                for (int l = 0; l < N; l++)
+                {
+                    lanes |= uint32_t(reached[l]) << l;
+                }
+                lanes &= p.active;
+
+                if (lanes)
+                {
+                    if (node.count > 0)
+                    {
+                        hit_leaf(node.offset, node.count, lanes);
+                    }
+                    else
+                    {
+                        if (lead_inv[node.axis] < 0)
+                        {
+                            stack[sp++] = current + 1;
+                            current = node.offset;
+                        }
+                        else
+                        {
+                            stack[sp++] = node.offset;
+                            current = current + 1;
+                        }
+                        continue;
+                    }
+                }
+
+                if (sp == 0)
+                {
+                    break;
+                }
+                current = stack[--sp];
+            }
+        }
+
+        inline aabb bounds() const
+        {
+            if (nodes.empty())
+            {
+                return aabb();
+            }
+            return node_box(nodes[0]);
+        }
+
+        static inline aabb node_box(const bvh_node& n)
+        {
+            return aabb(vec3(n.bmin[0], n.bmin[1], n.bmin[2]), vec3(n.bmax[0], n.bmax[1], n.bmax[2]));
+        }
+
+        std::vector<bvh_node> nodes;
+        std::vector<uint32_t> prim_order;
+        double build_ms = 0;
+        std::vector<float> built_area; //each node's half_area() right after the build
+
+        static const int num_bins = 16;
+        static const int max_leaf_size = 4;
+        static const uint32_t parallel_threshold = 16384;
+        static const int max_depth = 60; //keeps the traversal stack from overflowing
+
+    private:
+        //tree node used only while building, before flattening
+        struct build_node
+        {
+            aabb box;
+            uint32_t first = 0, count = 0;
+            int axis = 0;
+            std::unique_ptr<build_node> child[2];
+        };
+
+        struct bin
+        {
+            aabb box;
+            uint32_t count = 0;
+        };
+
+        //plain compares rather than fminf/fmaxf, which have to handle NaNs and so
+        //don't compile down to single min/max instructions
+        static inline float min_f(float a, float b) { return a < b ? a : b; }
+        static inline float max_f(float a, float b) { return a > b ? a : b; }
+
+        static inline bool node_hit(const bvh_node& n, const float* org, const float* inv_dir, float t_min, float t_max)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                float t0 = (n.bmin[a] - org[a]) * inv_dir[a];
+                float t1 = (n.bmax[a] - org[a]) * inv_dir[a];
+                t_min = max_f(t_min, min_f(t0, t1));
+                t_max = min_f(t_max, max_f(t0, t1));
+            }
+            return t_min <= t_max;
+        }
+
+        std::unique_ptr<build_node> build_range(const std::vector<aabb>& boxes, const std::vector<vec3>& centroids,
+                                                uint32_t begin, uint32_t end, int depth, int& node_count)
+        {
+            std::unique_ptr<build_node> node(new build_node());
+            node_count++;
+
+            aabb centroid_box;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                node->box.expand(boxes[prim_order[i]]);
+                centroid_box.expand(centroids[prim_order[i]]);
+            }
+
+            uint32_t count = end - begin;
+            node->first = begin;
+            node->count = count;
+            if (count == 1 || depth >= max_depth)
+            {
+                return node;
+            }
+
+            //bin centroids along each axis and find the cheapest split
+            float best_cost = FLT_MAX;
+            int best_axis = -1;
+            int best_split = 0;
+            vec3 cmin = centroid_box.min();
+            vec3 extent = centroid_box.max() - cmin;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (extent[axis] <= 0)
+                {
+                    continue;
+                }
+                float to_bin = num_bins * (1 - 1e-5f) / extent[axis];
+
+                bin bins[num_bins];
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    //the slack in to_bin keeps float centroids below num_bins, but not double ones
+                    int b = std::min(int((centroids[prim_order[i]][axis] - cmin[axis]) * to_bin), num_bins - 1);
+                    bins[b].count++;
+                    bins[b].box.expand(boxes[prim_order[i]]);
+                }
+
+                //sweep from the right to get the area/count of everything past each split
+                float right_area[num_bins];
+                uint32_t right_count[num_bins];
+                aabb acc;
+                uint32_t n = 0;
+                for (int b = num_bins - 1; b > 0; b--)
+                {
+                    acc.expand(bins[b].box);
+                    n += bins[b].count;
+                    right_area[b] = acc.half_area();
+                    right_count[b] = n;
+                }
+
+                acc = aabb();
+                n = 0;
+                for (int b = 0; b < num_bins - 1; b++)
+                {
+                    acc.expand(bins[b].box);
+                    n += bins[b].count;
+                    if (n == 0 || right_count[b + 1] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = acc.half_area() * n + right_area[b + 1] * right_count[b + 1];
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = b;
+                    }
+                }
+            }
+
+            //traversal cost of 1, intersection cost of 1 per primitive
+            float leaf_cost = float(count);
+            float split_cost = 1.0f + best_cost / node->box.half_area();
+            if (count <= max_leaf_size && (best_axis < 0 || leaf_cost <= split_cost))
+            {
+                return node;
+            }
+
+            uint32_t mid;
+            if (best_axis >= 0)
+            {
+                float to_bin = num_bins * (1 - 1e-5f) / extent[best_axis];
+                uint32_t *split = std::partition(&prim_order[begin], &prim_order[begin] + count,
+                    [&](uint32_t p)
+                    {
+                        return int((centroids[p][best_axis] - cmin[best_axis]) * to_bin) <= best_split;
+                    });
+                mid = uint32_t(split - &prim_order[0]);
+                node->axis = best_axis;
+            }
+            else
+            {
+                //every centroid is in the same spot, so just cut the list in half
+                mid = begin + count / 2;
+                node->axis = 0;
+            }
+
+            node->count = 0;
+            if (count > parallel_threshold && spare_threads.fetch_sub(1) > 0)
+            {
+                int left_count = 0;
+                std::thread left([&]()
+                {
+                    node->child[0] = build_range(boxes, centroids, begin, mid, depth + 1, left_count);
+                });
+                node->child[1] = build_range(boxes, centroids, mid, end, depth + 1, node_count);
+                left.join();
+                spare_threads++;
+                node_count += left_count;
+            }
+            else
+            {
+                if (count > parallel_threshold)
+                {
+                    spare_threads++; //undo the failed claim
+                }
+                node->child[0] = build_range(boxes, centroids, begin, mid, depth + 1, node_count);
+                node->child[1] = build_range(boxes, centroids, mid, end, depth + 1, node_count);
+            }
+
+            return node;
+        }
+
+        void flatten(const build_node *b)
+        {
+            uint32_t index = uint32_t(nodes.size());
+            nodes.push_back(bvh_node());
+            bvh_node& n = nodes.back();
+            for (int a = 0; a < 3; a++)
+            {
+                n.bmin[a] = b->box.min()[a];
+                n.bmax[a] = b->box.max()[a];
+            }
+            n.axis = uint16_t(b->axis);
+            n.count = uint16_t(b->count);
+            n.offset = b->first;
+
+            if (b->count == 0)
+            {
+                flatten(b->child[0].get());
+                uint32_t second = uint32_t(nodes.size());
+                flatten(b->child[1].get());
+                nodes[index].offset = second; //push_back may have moved n
+            }
+        }
+
+        std::atomic<int> spare_threads{0};
+};
+
+class bvh: public hitable
+{
+    public:
+        bvh() {}
+        bvh(hitable **l, int n, int num_threads = 0)
+        {
+            std::vector<aabb> boxes(n);
+            for (int i = 0; i < n; i++)
+            {
+                l[i]->bounding_box(boxes[i]);
+            }
+
+            tree.build(boxes, num_threads);
+
+            //store the objects in leaf order so each leaf is a contiguous run
+            prims.resize(n);
+            for (int i = 0; i < n; i++)
+            {
+                prims[i] = l[tree.prim_order[i]];
+            }
+        }
+
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
+        {
+            return tree.traverse(r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, float& closest_so_far)
+                {
+                    bool hit_anything = false;
+                    for (uint32_t i = first; i < first + count; i++)
+                    {
+                        if (prims[i]->intersect(r, t_min, closest_so_far, h))
+                        {
+                            hit_anything = true;
+                            closest_so_far = h.t;
+                        }
+                    }
+                    return hit_anything;
+                });
+        }
+
+        virtual bool occluded(const ray& r, float t_min, float t_max) const
+        {
+            return tree.traverse_any(r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, float& t)
+                {
+                    for (uint32_t i = first; i < first + count; i++)
+                    {
+                        if (prims[i]->occluded(r, t_min, t))
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+        }
+
+        /* finds the closest hit nearer than closest[lane] for every active lane of p, shrinking closest[lane]
+         * to it and filling hits[lane]; returns the mask of lanes that found one
+         * each lane gets exactly the hit a separate call to intersect() with t_max = closest[lane] would give it
+         */
+        template <int N>
+        uint32_t intersect_packet(const ray_packet<N>& p, float t_min, float *closest, ray_hit *hits) const
+        {
+            ray rays[N];
+            for (int l = 0; l < N; l++)
+            {
+                rays[l] = p.get(l);
+            }
+
+            uint32_t hit_mask = 0;
+            tree.traverse_packet(p, t_min, closest,
+                [&](uint32_t first, uint32_t count, uint32_t lanes)
+                {
+                    for (; lanes; lanes &= lanes - 1)
+                    {
+                        int l = __builtin_ctz(lanes);
+                        for (uint32_t i = first; i < first + count; i++)
+                        {
+                            if (prims[i]->intersect(rays[l], t_min, closest[l], hits[l]))
+                            {
+                                hit_mask |= 1u << l;
+                                closest[l] = hits[l].t;
+                            }
+                        }
+                    }
+                });
+            return hit_mask;
+        }
+
+        virtual bool bounding_box(aabb& box) const
+        {
+            box = tree.bounds();
+            return !tree.nodes.empty();
+        }
+
+        //fits the tree to wherever the objects are now, e.g. after an animation moved them
+        void refit()
+        {
+            leaf_boxes.resize(prims.size());
+            for (size_t i = 0; i < prims.size(); i++)
+            {
+                prims[i]->bounding_box(leaf_boxes[i]);
+            }
+            tree.refit(leaf_boxes.data());
+        }
+
+        std::vector<hitable*> prims;
+        bvh_tree tree;
+
+    private:
+        std::vector<aabb> leaf_boxes; //kept between refits so they don't allocate
+};
+
+#endif
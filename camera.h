@@ -10,14 +10,38 @@
 #define CAMERAH
 
 #include "ray.h"
+#include "rng.h"
 
 //returns a random point in the unit disk
-vec3 random_in_unit_disk()
+vec3 random_in_unit_disk(rng& gen)
 {
+    if (gen.low_discrepancy())
+    {
+        //Shirley and Chiu's concentric map, which takes evenly spread squares to evenly spread disks
+        float a = 2 * gen.next() - 1;
+        float b = 2 * gen.next() - 1;
+        if (a == 0 && b == 0)
+        {
+            return vec3(0, 0, 0);
+        }
+        float r, theta;
+        if (fabsf(a) > fabsf(b))
+        {
+            r = a;
+            theta = float(M_PI / 4) * (b / a);
+        }
+        else
+        {
+            r = b;
+            theta = float(M_PI / 2) - float(M_PI / 4) * (a / b);
+        }
+        return vec3(r * cosf(theta), r * sinf(theta), 0);
+    }
+
     vec3 p;
     do
     {
-        p = vec3::scale(vec3(drand48(), drand48(), 0), 2.0) -  vec3(1, 1, 0);
+        p = vec3::scale(vec3(gen.next(), gen.next(), 0), 2.0) -  vec3(1, 1, 0);
     } while (vec3::dot(p, p) >= 1.0);
     return p;
 }
@@ -43,12 +67,12 @@ class camera
             vertical = vec3::scale(v, 2*half_height*focus_dist);
         }
 
-        ray get_ray(float s, float t)
+        ray get_ray(float s, float t, rng& gen) const
         {
-            vec3 rd = vec3::scale(random_in_unit_disk(), lens_radius);
+            vec3 rd = vec3::scale(random_in_unit_disk(gen), lens_radius);
             vec3 offset = vec3::scale(u, rd.x()) + vec3::scale(v, rd.y());
             return ray(origin + offset,
-                       lower_left_corner + vec3::scale(horizontal, s) + vec3::scale(vertical, t) - origin - offset);
+                       vec3::mul_add(vec3::mul_add(lower_left_corner, horizontal, s), vertical, t) - origin - offset);
         }
 
         vec3 origin;
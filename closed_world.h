@@ -0,0 +1,372 @@
+/* closed_world.h
+ * Defines closed_world, a copy of a scene for the path tracer in which every primitive and material
+ * is one of a fixed set of types: spheres, meshes and planes, lambertian, metal, dielectric and diffuse_light
+ * each is kept by value in a std::variant and dispatched with a switch on its index that the
+ * compiler generates and can see through, instead of hitable::hit and material::scatter going
+ * through the vtable; that lets it inline the sphere test and the scatter functions into the
+ * path loop of shade() and optimize them together
+ * the class hierarchy stays as it is for anything else; a scene with any other kind of object or
+ * material just can't be closed, and renders through the virtual calls as before
+ * it traces against the scene's own BVH, so it has to be rebuilt (which only copies) whenever
+ * the scene's BVH is refitted or rebuilt, and it makes exactly the hits and scatters the scene does
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef CLOSEDWORLDH
+#define CLOSEDWORLDH
+
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include "scene.h"
+#include "renderer.h"
+#include "sphere.h"
+#include "mesh.h"
+#include "plane.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "dielectric.h"
+#include "diffuse_light.h"
+#include "lights.h"
+
+/* calls f on whatever v holds: an if-chain on the index, generated one alternative at a time,
+ * which the compiler turns into a switch with every call inlined
+ * (std::visit is allowed to, and in some standard libraries does, go through a table of function pointers)
+ */
+template <size_t I = 0, typename V, typename F>
+inline decltype(auto) visit_inline(const V& v, F&& f)
+{
+    if constexpr (I + 1 < std::variant_size<V>::value)
+    {
+        if (v.index() != I)
+        {
+            return visit_inline<I + 1>(v, f);
+        }
+    }
+    return f(*std::get_if<I>(&v));
+}
+
+//a sphere without the hitable around it, so without a vtable pointer
+struct closed_sphere
+{
+    vec3 center;
+    float radius;
+    uint32_t mat_id;
+};
+
+//and a plane, which is tested on its own before the BVH, as in the scene
+struct closed_plane
+{
+    vec3 point;
+    vec3 normal;
+    uint32_t mat_id;
+};
+
+typedef std::variant<closed_sphere, const mesh*> closed_primitive;
+typedef std::variant<lambertian, metal, dielectric, diffuse_light> closed_material;
+
+class closed_world
+{
+    public:
+        /* copies sc's objects, in its BVH's leaf order, its unbounded objects and its materials,
+         * and uses its lights and sky
+         * sc has to have a BVH; returns false with the reason in why_not if it doesn't,
+         * or if anything in it isn't one of the closed set of types
+         */
+        bool build(const scene& sc, std::string& why_not)
+        {
+            prims.clear();
+            planes.clear();
+            sources.clear();
+            materials.clear();
+            tree = 0;
+            lights = &sc.lights;
+            sky_color = sc.sky_color;
+            if (!sc.tree)
+            {
+                why_not = "the scene has no BVH";
+                return false;
+            }
+
+            for (size_t k = 0; k < sc.tree->prims.size(); k++)
+            {
+                const hitable *h = sc.tree->prims[k];
+                if (const sphere *s = dynamic_cast<const sphere*>(h))
+                {
+                    prims.push_back(closed_sphere{ s->center, s->radius, s->mat_id });
+                    sources.push_back(s);
+                }
+                else if (const mesh *m = dynamic_cast<const mesh*>(h))
+                {
+                    prims.push_back(m);
+                    sources.push_back(m);
+                }
+                else
+                {
+                    why_not = "the scene has objects other than spheres, meshes and planes";
+                    return false;
+                }
+            }
+            for (size_t k = 0; k < sc.unbounded.size(); k++)
+            {
+                const plane *p = dynamic_cast<const plane*>(sc.unbounded[k]);
+                if (!p)
+                {
+                    why_not = "the scene has unbounded objects other than planes";
+                    return false;
+                }
+                planes.push_back(closed_plane{ p->point, p->normal, p->mat_id });
+                sources.push_back(p);
+            }
+
+            for (size_t k = 0; k < sc.materials.size(); k++)
+            {
+                const material *m = sc.materials[k];
+                switch (m->type)
+                {
+                    case material_lambertian:
+                        materials.push_back(*static_cast<const lambertian*>(m));
+                        break;
+                    case material_metal:
+                        materials.push_back(*static_cast<const metal*>(m));
+                        break;
+                    case material_dielectric:
+                        materials.push_back(*static_cast<const dielectric*>(m));
+                        break;
+                    case material_light:
+                        materials.push_back(*static_cast<const diffuse_light*>(m));
+                        break;
+                    default:
+                        why_not = "material " + std::to_string(k) + " isn't lambertian, metal, dielectric or a light";
+                        return false;
+                }
+            }
+
+            tree = &sc.tree->tree;
+            return true;
+        }
+
+        /* the same closest hit the scene's world finds: the planes, then the BVH
+         * while searching, a sphere hit is kept as its index in prims with no object, a plane hit the same way
+         * with the planes numbered after prims, and a mesh hit as the mesh's own ray_hit,
+         * so the surface is worked out once at the end either way
+         */
+        bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+        {
+            ray_hit h;
+            bool hit_anything = false;
+            for (size_t k = 0; k < planes.size(); k++)
+            {
+                float t;
+                if (plane::intersect_plane(planes[k].point, planes[k].normal, r, t_min, t_max, t))
+                {
+                    hit_anything = true;
+                    t_max = t;
+                    h.t = t;
+                    h.object = 0;
+                    h.prim = uint32_t(prims.size() + k);
+                }
+            }
+            hit_anything |= tree->traverse(r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, float& closest_so_far)
+                {
+                    bool found = false;
+                    for (uint32_t i = first; i < first + count; i++)
+                    {
+                        bool hit = visit_inline(prims[i], [&](const auto& p)
+                        {
+                            return intersect(p, i, r, t_min, closest_so_far, h);
+                        });
+                        if (hit)
+                        {
+                            found = true;
+                            closest_so_far = h.t;
+                        }
+                    }
+                    return found;
+                });
+            if (!hit_anything)
+            {
+                return false;
+            }
+
+            if (h.object)
+            {
+                static_cast<const mesh*>(h.object)->mesh::surface(r, h, rec);
+            }
+            else if (h.prim >= prims.size())
+            {
+                const closed_plane& p = planes[h.prim - prims.size()];
+                plane::plane_surface(p.normal, p.mat_id, r, h.t, rec);
+                rec.object = sources[h.prim];
+            }
+            else
+            {
+                const closed_sphere& s = *std::get_if<closed_sphere>(&prims[h.prim]);
+                sphere::sphere_surface(s.center, s.radius, s.mat_id, r, h.t, rec);
+                rec.object = sources[h.prim];
+            }
+            return true;
+        }
+
+        //whether anything at all is in the way, stopping at the first thing found
+        bool occluded(const ray& r, float t_min, float t_max) const
+        {
+            for (size_t k = 0; k < planes.size(); k++)
+            {
+                float t;
+                if (plane::intersect_plane(planes[k].point, planes[k].normal, r, t_min, t_max, t))
+                {
+                    return true;
+                }
+            }
+            return tree->traverse_any(r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, float& t)
+                {
+                    for (uint32_t i = first; i < first + count; i++)
+                    {
+                        if (visit_inline(prims[i], [&](const auto& p) { return occludes(p, r, t_min, t); }))
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+        }
+
+        bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, rng& gen) const
+        {
+            return visit_inline(materials[rec.mat_id], [&](const auto& m)
+            {
+                //qualified with the class, so it's a direct call even though scatter is virtual
+                typedef typename std::decay<decltype(m)>::type M;
+                return m.M::scatter(r_in, rec, attenuation, scattered, gen);
+            });
+        }
+
+        inline bool emits(const hit_record& rec) const
+        {
+            return std::holds_alternative<diffuse_light>(materials[rec.mat_id]);
+        }
+
+        vec3 emitted(const ray& r_in, const hit_record& rec) const
+        {
+            return visit_inline(materials[rec.mat_id], [&](const auto& m)
+            {
+                typedef typename std::decay<decltype(m)>::type M;
+                return m.M::emitted(r_in, rec);
+            });
+        }
+
+        vec3 eval(const ray& r_in, const hit_record& rec, const vec3& direction, float& pdf) const
+        {
+            return visit_inline(materials[rec.mat_id], [&](const auto& m)
+            {
+                typedef typename std::decay<decltype(m)>::type M;
+                return m.M::eval(r_in, rec, direction, pdf);
+            });
+        }
+
+        bool specular(const hit_record& rec) const
+        {
+            return visit_inline(materials[rec.mat_id], [&](const auto& m)
+            {
+                typedef typename std::decay<decltype(m)>::type M;
+                return m.M::specular();
+            });
+        }
+
+        std::vector<closed_primitive> prims; //in the BVH's leaf order
+        std::vector<closed_plane> planes;
+        std::vector<const hitable*> sources; //the scene's object behind each of prims, then each of planes
+        std::vector<closed_material> materials;
+        const bvh_tree *tree = 0;
+        const light_set *lights = 0; //the scene's; its spheres and meshes are the scene's objects, not the copies here
+        vec3 sky_color;
+
+    private:
+        static inline bool intersect(const closed_sphere& s, uint32_t index, const ray& r, float t_min, float t_max,
+                                     ray_hit& h)
+        {
+            float t;
+            if (!sphere::intersect_sphere(s.center, s.radius, r, t_min, t_max, t))
+            {
+                return false;
+            }
+            h.t = t;
+            h.object = 0;
+            h.prim = index;
+            return true;
+        }
+
+        //a direct call too, but a whole BVH walk of its own, so it's left to the compiler whether it gets inlined
+        static inline bool intersect(const mesh *m, uint32_t, const ray& r, float t_min, float t_max, ray_hit& h)
+        {
+            return m->mesh::intersect(r, t_min, t_max, h);
+        }
+
+        static inline bool occludes(const closed_sphere& s, const ray& r, float t_min, float t_max)
+        {
+            float t;
+            return sphere::intersect_sphere(s.center, s.radius, r, t_min, t_max, t);
+        }
+
+        static inline bool occludes(const mesh *m, const ray& r, float t_min, float t_max)
+        {
+            return m->mesh::occluded(r, t_min, t_max);
+        }
+};
+
+//the path tracer's view of a closed world (see renderer.h)
+inline bool world_hit(const closed_world& w, const ray& r, float t_min, float t_max, hit_record& rec)
+{
+    return w.hit(r, t_min, t_max, rec);
+}
+
+inline bool world_scatter(const closed_world& w, const ray& r_in, const hit_record& rec, vec3& attenuation,
+                          ray& scattered, rng& gen)
+{
+    return w.scatter(r_in, rec, attenuation, scattered, gen);
+}
+
+inline bool world_occluded(const closed_world& w, const ray& r, float t_min, float t_max)
+{
+    return w.occluded(r, t_min, t_max);
+}
+
+inline bool world_emits(const closed_world& w, const hit_record& rec)
+{
+    return w.emits(rec);
+}
+
+inline vec3 world_emitted(const closed_world& w, const ray& r_in, const hit_record& rec)
+{
+    return w.emitted(r_in, rec);
+}
+
+inline vec3 world_eval(const closed_world& w, const ray& r_in, const hit_record& rec, const vec3& direction,
+                       float& pdf)
+{
+    return w.eval(r_in, rec, direction, pdf);
+}
+
+inline bool world_specular(const closed_world& w, const hit_record& rec)
+{
+    return w.specular(rec);
+}
+
+inline const light_set& world_lights(const closed_world& w)
+{
+    return *w.lights;
+}
+
+inline vec3 world_sky(const closed_world& w, const ray& r)
+{
+    return w.sky_color * sky(r);
+}
+
+#endif
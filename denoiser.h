@@ -0,0 +1,280 @@
+/* denoiser.h
+ * A post-pass that takes the noise out of a low sample count render, guided by what the camera
+ * rays hit first: the surface normal, its albedo and its distance (the auxiliary buffers, or AOVs)
+ * those come out nearly noise-free after a few samples, so where they change there's an edge
+ * the filter shouldn't blur across, and where they don't the noisy color can be averaged freely
+ * the filter is the edge-avoiding a-trous wavelet transform of Dammertz et al. (2010): a 5x5
+ * B3 spline kernel applied a few times with its taps spread further apart each time (1, 2, 4, ...
+ * pixels), so a wide blur costs 25 taps per pixel per iteration instead of one tap per pixel covered
+ * it filters the lighting rather than the color: color divided by albedo, multiplied back in after,
+ * so texture from the albedo stays sharp and only the shading gets smoothed
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef DENOISERH
+#define DENOISERH
+
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include "renderer.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "render_scheduler.h"
+
+const float miss_depth = 1e4f; //depth of pixels that see only sky, far past anything in a scene
+
+//first hit of every pixel, averaged over a few of its samples, rows from the bottom up
+class aov_buffers
+{
+    public:
+        aov_buffers(int w, int h) : width(w), height(h), normal(w, h), albedo(w, h), depth(size_t(w) * h, 0.0f) {}
+
+        int width;
+        int height;
+        framebuffer normal; //unit normal; 0 where the sky was hit
+        framebuffer albedo; //surface color; for the sky, the sky's color
+        std::vector<float> depth; //ray t, or miss_depth
+};
+
+/* the color a surface gives the light hitting it: albedo for lambertian and metal,
+ * white for glass and anything else that doesn't tint what it scatters
+ */
+vec3 surface_albedo(const material *m)
+{
+    switch (m->type)
+    {
+        case material_lambertian: return static_cast<const lambertian*>(m)->albedo;
+        case material_metal: return static_cast<const metal*>(m)->albedo;
+        default: return vec3(1, 1, 1);
+    }
+}
+
+/* fills the AOVs for one tile from the first hits of samples 0 to samples - 1 of each pixel
+ * the camera rays are the same ones the render traces for those samples
+ */
+void render_tile_aovs(const tile& t, const scene& sc, const camera& cam, const render_settings& rs, int samples,
+                      aov_buffers& aov)
+{
+    for (int j = t.y0; j < t.y1; j++)
+    {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+            vec3 normal(0, 0, 0), albedo(0, 0, 0);
+            float depth = 0;
+            for (int s = 0; s < samples; s++)
+            {
+                rng gen(j * rs.width + i, s, rs.source);
+                float u = float(i + gen.next()) / float(rs.width);
+                float v = float(j + gen.next()) / float(rs.height);
+                ray r = cam.get_ray(u, v, gen);
+                hit_record rec;
+                if (sc.world->hit(r, 0.001, MAXFLOAT, rec))
+                {
+                    normal += rec.normal;
+                    albedo += surface_albedo(sc.get_material(rec.mat_id));
+                    depth += rec.t;
+                }
+                else
+                {
+                    albedo += world_sky(sc, r);
+                    depth += miss_depth;
+                }
+            }
+            float scale = 1.0f / samples;
+            aov.normal.set(i, j, vec3::scale(normal, scale));
+            aov.albedo.set(i, j, vec3::scale(albedo, scale));
+            aov.depth[size_t(j) * aov.width + i] = depth * scale;
+        }
+    }
+}
+
+struct denoise_settings
+{
+    int iterations = 4;           //tap spacing doubles each time, so 4 reaches 2 * (1 + 2 + 4 + 8) = 30 pixels out
+    float sigma_luminance = 3.0f; //how many standard deviations of noise two pixels' lighting can differ by
+    float sigma_normal = 0.3f;    //the AOV weights fall off as exp(-difference^2 / sigma^2)
+    float sigma_albedo = 0.2f;
+    float sigma_depth = 0.05f;    //depth differences are relative to the pixel's own depth, and fall off linearly
+    int aov_samples = 16;         //first hits averaged into the AOVs, capped at the render's sample count
+};
+
+inline float luminance(const float *c)
+{
+    return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+/* one a-trous iteration over a tile: each pixel of dst becomes a weighted average of the 5x5 pixels
+ * of src around it that are step pixels apart, and its variance goes down to match
+ * how much lighting differences count depends on how noisy the pixel is (Schied et al.,
+ * "Spatiotemporal Variance-Guided Filtering", 2017): a difference well within the noise
+ * is averaged away, one well outside it is an edge, like a shadow's, that the AOVs can't see
+ */
+void atrous_tile(const tile& t, const framebuffer& src, const aov_buffers& aov, int step, const denoise_settings& ds,
+                 framebuffer& dst)
+{
+    static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+    const float inv_normal = 1 / (ds.sigma_normal * ds.sigma_normal);
+    const float inv_albedo = 1 / (ds.sigma_albedo * ds.sigma_albedo);
+
+    for (int j = t.y0; j < t.y1; j++)
+    {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+            const float *c = src.pixel(i, j);
+            const float *n = aov.normal.pixel(i, j);
+            const float *a = aov.albedo.pixel(i, j);
+            float y = luminance(c);
+            float z = aov.depth[size_t(j) * aov.width + i];
+            float inv_z = 1 / (ds.sigma_depth * z);
+
+            //the variance itself is noisy, so it's blurred over the 3x3 pixels around first
+            float variance = 0, variance_weight = 0;
+            for (int vy = std::max(j - 1, 0); vy <= std::min(j + 1, src.height - 1); vy++)
+            {
+                for (int vx = std::max(i - 1, 0); vx <= std::min(i + 1, src.width - 1); vx++)
+                {
+                    float w = (vx == i ? 0.5f : 0.25f) * (vy == j ? 0.5f : 0.25f);
+                    variance += w * src.variance[size_t(vy) * src.width + vx];
+                    variance_weight += w;
+                }
+            }
+            float inv_y = 1 / (ds.sigma_luminance * sqrtf(variance / variance_weight) + 1e-4f);
+
+            float sum[3] = { 0, 0, 0 };
+            float sum_variance = 0;
+            float total = 0;
+            for (int dy = -2; dy <= 2; dy++)
+            {
+                int qy = j + dy * step;
+                if (qy < 0 || qy >= src.height)
+                {
+                    continue;
+                }
+                for (int dx = -2; dx <= 2; dx++)
+                {
+                    int qx = i + dx * step;
+                    if (qx < 0 || qx >= src.width)
+                    {
+                        continue;
+                    }
+
+                    size_t q = size_t(qy) * src.width + qx;
+                    const float *cq = src.pixel(qx, qy);
+                    const float *nq = aov.normal.pixel(qx, qy);
+                    const float *aq = aov.albedo.pixel(qx, qy);
+                    float dn = 0, da = 0;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        dn += (n[k] - nq[k]) * (n[k] - nq[k]);
+                        da += (a[k] - aq[k]) * (a[k] - aq[k]);
+                    }
+                    //every edge-stopping function multiplied together is one exp of their exponents summed
+                    float w = kernel[dx + 2] * kernel[dy + 2] *
+                              expf(-(fabsf(y - luminance(cq)) * inv_y + dn * inv_normal + da * inv_albedo +
+                                     fabsf(z - aov.depth[q]) * inv_z));
+                    sum[0] += w * cq[0];
+                    sum[1] += w * cq[1];
+                    sum[2] += w * cq[2];
+                    sum_variance += w * w * src.variance[q];
+                    total += w;
+                }
+            }
+
+            //the center tap always has weight kernel[2]^2, so total is never 0
+            float *out = dst.pixel(i, j);
+            out[0] = sum[0] / total;
+            out[1] = sum[1] / total;
+            out[2] = sum[2] / total;
+            dst.variance[size_t(j) * dst.width + i] = sum_variance / (total * total);
+        }
+    }
+}
+
+/* denoises fb in place, guided by aov, on num_threads threads (0 = one per hardware thread)
+ * fb has to have kept its variance (framebuffer::keep_variance()) while it was rendered
+ */
+void denoise(framebuffer& fb, const aov_buffers& aov, const denoise_settings& ds, int num_threads)
+{
+    STATS_TIMER(timer_denoise);
+    const float min_albedo = 0.01f;    //black surfaces would divide by 0; their lighting doesn't show anyway
+    const float max_variance = 1e4f;   //pixels with a single sample have infinite variance, which would turn into NaNs
+
+    //lighting = color / albedo, with the variance scaled to match
+    framebuffer lighting(fb.width, fb.height), temp(fb.width, fb.height);
+    lighting.keep_variance();
+    temp.keep_variance();
+    for (size_t p = 0; p < lighting.variance.size(); p++)
+    {
+        float albedo[3];
+        for (int k = 0; k < 3; k++)
+        {
+            albedo[k] = fmaxf(aov.albedo.rgb[p * 3 + k], min_albedo);
+            lighting.rgb[p * 3 + k] = fb.rgb[p * 3 + k] / albedo[k];
+        }
+        float scale = 1 / luminance(albedo);
+        lighting.variance[p] = fminf(fb.variance[p] * scale * scale, max_variance);
+    }
+
+    //every pixel costs the same, so each thread just takes an even band of rows
+    //(not render_scheduler, whose runs count as render time in the statistics)
+    if (num_threads <= 0)
+    {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, fb.height);
+    for (int it = 0; it < ds.iterations; it++)
+    {
+        auto band = [&](int id)
+        {
+            tile t = { 0, fb.height * id / num_threads, fb.width, fb.height * (id + 1) / num_threads };
+            atrous_tile(t, lighting, aov, 1 << it, ds, temp);
+        };
+        std::vector<std::thread> threads;
+        for (int id = 1; id < num_threads; id++)
+        {
+            threads.push_back(std::thread(band, id));
+        }
+        band(0);
+        for (size_t k = 0; k < threads.size(); k++)
+        {
+            threads[k].join();
+        }
+        lighting.rgb.swap(temp.rgb);
+        lighting.variance.swap(temp.variance);
+    }
+
+    for (size_t k = 0; k < fb.rgb.size(); k++)
+    {
+        fb.rgb[k] = lighting.rgb[k] * fmaxf(aov.albedo.rgb[k], min_albedo);
+    }
+}
+
+//writes the AOVs next to base as base.normal.pfm, base.albedo.pfm and base.depth.pfm; false if any failed
+bool write_aovs(const aov_buffers& aov, const std::string& base)
+{
+    framebuffer depth(aov.width, aov.height);
+    for (size_t k = 0; k < aov.depth.size(); k++)
+    {
+        depth.rgb[k * 3] = depth.rgb[k * 3 + 1] = depth.rgb[k * 3 + 2] = aov.depth[k];
+    }
+
+    const framebuffer *images[3] = { &aov.normal, &aov.albedo, &depth };
+    const char *names[3] = { ".normal.pfm", ".albedo.pfm", ".depth.pfm" };
+    bool ok = true;
+    for (int k = 0; k < 3; k++)
+    {
+        image_output out((base + names[k]).c_str(), aov.width, aov.height, format_pfm);
+        out.write_all(*images[k]);
+        ok = out.ok() && out.finish() && ok;
+    }
+    return ok;
+}
+
+#endif
@@ -45,10 +45,11 @@ float schlick(float cos, float ref_idx)
 class dielectric: public material
 {
     public:
-        dielectric(float ri) : refract_idx(ri) {}
+        dielectric(float ri) : material(material_dielectric), refract_idx(ri) {}
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, rng& gen) const
         {
+            STATS_COUNT(stat_scatter_dielectric);
             vec3 reflected = reflect(vec3::unit_vector(r_in.direction()), rec.normal);
             attenuation = vec3(1.0, 1.0, 1.0);
             vec3 outward_normal;
@@ -81,7 +82,7 @@ class dielectric: public material
             }
 
             //decide whether to reflect or not
-            if (drand48() < reflect_prob)
+            if (gen.next() < reflect_prob)
             {
                 scattered = ray(rec.p, reflected);
             }
@@ -0,0 +1,34 @@
+/* diffuse_light.h
+ * Defines the diffuse_light class, a subclass of material for surfaces that give off light:
+ * the same radiance in every direction off the side their normal faces, and nothing off the back
+ * it doesn't reflect anything, so paths end on it
+ * see Shirley, "Ray Tracing: The Next Week" (2016), ch 6
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef DIFFUSELIGHTH
+#define DIFFUSELIGHTH
+
+#include "material.h"
+
+class diffuse_light: public material
+{
+    public:
+        diffuse_light(const vec3& l) : material(material_light), radiance(l) {}
+
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, rng& gen) const
+        {
+            return false;
+        }
+
+        virtual vec3 emitted(const ray& r_in, const hit_record& rec) const
+        {
+            return vec3::dot(r_in.direction(), rec.normal) < 0 ? radiance : vec3(0, 0, 0);
+        }
+
+        vec3 radiance;
+};
+
+#endif
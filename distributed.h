@@ -0,0 +1,493 @@
+/* distributed.h
+ * Rendering across several processes: a coordinator hands tiles to worker processes over sockets
+ * and merges the per-pixel estimates they send back
+ * workers are forked from the coordinator after the scene is loaded, so they share its memory
+ * instead of loading the scene again, or are started on other machines with the same scene options
+ * and connect over TCP; a worker has to present the coordinator's render fingerprint to be used
+ * a tile's result only depends on the tile (sample s of a pixel always uses rng(pixel, s)),
+ * so the image is the same whichever worker renders which tile, and a tile whose worker dies
+ * is simply handed to another one; if every worker is gone, the coordinator renders the rest itself
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef DISTRIBUTEDH
+#define DISTRIBUTEDH
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include "renderer.h"
+#include "progressive.h"
+#include "render_scheduler.h"
+
+enum dist_message_type
+{
+    dist_hello = 1, //worker -> coordinator, value is the render fingerprint
+    dist_tile,      //coordinator -> worker, render this tile
+    dist_result,    //worker -> coordinator, value is the samples taken; the tile's pixel_estimates follow
+    dist_done       //coordinator -> worker, no more tiles
+};
+
+//every message starts with this; both ends are the same build, so it goes over the wire as is
+struct dist_message
+{
+    uint32_t type;
+    int32_t x0, y0, x1, y1;
+    uint32_t reserved;
+    uint64_t value;
+};
+
+const uint32_t dist_magic = 0x31575452; //"RTW1", sent as the first word of the hello's reserved field
+
+//sends or receives exactly n bytes; false if the other end went away
+bool send_all(int fd, const void *data, size_t n)
+{
+    const char *p = (const char*)data;
+    while (n > 0)
+    {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL); //a dead worker mustn't kill the coordinator with SIGPIPE
+        if (k < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (k <= 0)
+        {
+            return false;
+        }
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+bool recv_all(int fd, void *data, size_t n)
+{
+    char *p = (char*)data;
+    while (n > 0)
+    {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (k <= 0)
+        {
+            return false;
+        }
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+inline dist_message make_message(uint32_t type, const tile& t, uint64_t value)
+{
+    dist_message m;
+    memset(&m, 0, sizeof(m));
+    m.type = type;
+    m.x0 = t.x0;
+    m.y0 = t.y0;
+    m.x1 = t.x1;
+    m.y1 = t.y1;
+    m.value = value;
+    return m;
+}
+
+inline size_t tile_pixels(const tile& t)
+{
+    return size_t(t.x1 - t.x0) * (t.y1 - t.y0);
+}
+
+/* the worker side: says hello, then renders every tile it's sent until told it's done
+ * returns the process exit code
+ */
+int run_worker(int fd, const scene& sc, const camera& cam, const render_settings& rs, uint64_t fingerprint)
+{
+    tile none = { 0, 0, 0, 0 };
+    dist_message hello = make_message(dist_hello, none, fingerprint);
+    hello.reserved = dist_magic;
+    if (!send_all(fd, &hello, sizeof(hello)))
+    {
+        return 1;
+    }
+
+    accumulation_buffer acc(rs.width, rs.height);
+    framebuffer fb(rs.width, rs.height);
+    std::vector<pixel_estimate> out;
+    while (true)
+    {
+        dist_message m;
+        if (!recv_all(fd, &m, sizeof(m)))
+        {
+            return 1; //the coordinator went away
+        }
+        if (m.type == dist_done)
+        {
+            return 0;
+        }
+        tile t = { m.x0, m.y0, m.x1, m.y1 };
+        if (m.type != dist_tile || t.x0 < 0 || t.y0 < 0 || t.x1 > rs.width || t.y1 > rs.height ||
+            t.x0 >= t.x1 || t.y0 >= t.y1)
+        {
+            return 1;
+        }
+
+        uint64_t spent = render_tile_pass(t, sc, cam, rs, acc, rs.sampling.max_samples, fb);
+        out.clear();
+        for (int j = t.y0; j < t.y1; j++)
+        {
+            for (int i = t.x0; i < t.x1; i++)
+            {
+                out.push_back(acc.at(i, j));
+            }
+        }
+
+        dist_message result = make_message(dist_result, t, spent);
+        if (!send_all(fd, &result, sizeof(result)) ||
+            !send_all(fd, out.data(), out.size() * sizeof(pixel_estimate)))
+        {
+            return 1;
+        }
+    }
+}
+
+/* forks count worker processes, each running worker(fd) on its end of a socket pair and exiting with its result
+ * call before starting any threads: the children only get the thread that forked them
+ * fills fds and pids with the coordinator's end of each socket and the child's process id
+ */
+template <typename F>
+void spawn_workers(int count, F worker, std::vector<int>& fds, std::vector<pid_t>& pids)
+{
+    for (int w = 0; w < count; w++)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        {
+            break;
+        }
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(pair[0]);
+            close(pair[1]);
+            break;
+        }
+        if (pid == 0)
+        {
+            close(pair[0]);
+            for (size_t k = 0; k < fds.size(); k++)
+            {
+                close(fds[k]); //siblings' sockets, so a sibling's death is still seen as EOF
+            }
+            _exit(worker(pair[1])); //no destructors: they belong to the parent's objects
+        }
+        close(pair[1]);
+        fds.push_back(pair[0]);
+        pids.push_back(pid);
+    }
+}
+
+//listens for remote workers on port (all interfaces); returns the socket, or -1
+int listen_for_workers(int port)
+{
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int yes = 1, no = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)); //take IPv4 connections too
+    sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(uint16_t(port));
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//connects to a coordinator at "host:port"; returns the socket, or -1
+int connect_to_coordinator(const char *address)
+{
+    std::string host(address);
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos)
+    {
+        return -1;
+    }
+    std::string port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = 0;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+    {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *a = found; a && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd >= 0)
+    {
+        //results go out as a header then the pixels; don't let Nagle hold the header back
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return fd;
+}
+
+/* the coordinator side: hands out every tile of the image to the workers on fds (and any that connect
+ * to listen_fd, if it isn't -1), and calls on_result(tile, estimates) for each finished tile, with the
+ * tile's pixel_estimates row by row from the bottom
+ * with no workers left it renders tiles itself with render_local(tile), which should call on_result too;
+ * a connection only counts as a worker once it has said hello, and one that hasn't within hello_secs is
+ * dropped, so an idle connection to listen_fd can't hold the render up
+ * returns the number of samples the workers took
+ */
+class tile_coordinator
+{
+    public:
+        tile_coordinator(int w, int h, int tsize, uint64_t fp) : width(w), height(h), tile_size(tsize), fingerprint(fp)
+        {
+            assert(tile_size >= 1);
+        }
+
+        template <typename F, typename G>
+        uint64_t run(const std::vector<int>& fds, int listen_fd, F on_result, G render_local)
+        {
+            std::deque<tile> pending;
+            for (int y = 0; y < height; y += tile_size)
+            {
+                for (int x = 0; x < width; x += tile_size)
+                {
+                    tile t = { x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) };
+                    pending.push_back(t);
+                }
+            }
+            size_t remaining = pending.size();
+
+            workers.clear();
+            for (size_t k = 0; k < fds.size(); k++)
+            {
+                workers.push_back(worker_link{ fds[k], hello_deadline() });
+            }
+            worker_tiles.assign(workers.size(), 0);
+            local_tiles = 0;
+
+            uint64_t spent = 0;
+            std::vector<pixel_estimate> estimates;
+            while (remaining > 0)
+            {
+                //top every greeted worker up to in_flight tiles, and give up on ones that never said hello
+                int live = 0;
+                bool waiting_for_hello = false;
+                auto now = std::chrono::steady_clock::now();
+                for (size_t k = 0; k < workers.size(); k++)
+                {
+                    worker_link& w = workers[k];
+                    if (w.fd >= 0 && !w.greeted && now >= w.hello_by)
+                    {
+                        drop(w, pending);
+                    }
+                    waiting_for_hello |= w.fd >= 0 && !w.greeted;
+                    while (w.fd >= 0 && w.greeted && w.outstanding.size() < in_flight && !pending.empty())
+                    {
+                        dist_message m = make_message(dist_tile, pending.front(), 0);
+                        if (!send_all(w.fd, &m, sizeof(m)))
+                        {
+                            drop(w, pending);
+                            break;
+                        }
+                        w.outstanding.push_back(pending.front());
+                        pending.pop_front();
+                    }
+                    live += w.fd >= 0 && w.greeted;
+                }
+
+                if (live == 0 && !pending.empty())
+                {
+                    //nobody to hand tiles to: render one here, then look for new workers again
+                    render_local(pending.front());
+                    pending.pop_front();
+                    remaining--;
+                    local_tiles++;
+                    //the poll below still has to run if anyone could turn up: a new connection, or a hello
+                    if (listen_fd < 0 && !waiting_for_hello)
+                    {
+                        continue;
+                    }
+                }
+
+                std::vector<pollfd> polled;
+                std::vector<size_t> owner;
+                for (size_t k = 0; k < workers.size(); k++)
+                {
+                    if (workers[k].fd >= 0)
+                    {
+                        polled.push_back(pollfd{ workers[k].fd, POLLIN, 0 });
+                        owner.push_back(k);
+                    }
+                }
+                if (listen_fd >= 0)
+                {
+                    polled.push_back(pollfd{ listen_fd, POLLIN, 0 });
+                }
+                //with nobody working, just a look before the next local tile; with someone still to say hello,
+                //short enough to drop them in time; otherwise until something comes in
+                int timeout_ms = live == 0 ? 0 : waiting_for_hello ? 100 : -1;
+                if (polled.empty() || poll(polled.data(), polled.size(), timeout_ms) <= 0)
+                {
+                    continue;
+                }
+
+                for (size_t p = 0; p < owner.size(); p++)
+                {
+                    if (polled[p].revents == 0)
+                    {
+                        continue;
+                    }
+                    worker_link& w = workers[owner[p]];
+                    dist_message m;
+                    if (!recv_all(w.fd, &m, sizeof(m)))
+                    {
+                        drop(w, pending);
+                        continue;
+                    }
+
+                    if (!w.greeted)
+                    {
+                        if (m.type != dist_hello || m.reserved != dist_magic || m.value != fingerprint)
+                        {
+                            drop(w, pending); //some other program, or a worker with other settings
+                            continue;
+                        }
+                        w.greeted = true;
+                        continue;
+                    }
+
+                    //a worker renders its tiles in the order it got them
+                    tile t = { m.x0, m.y0, m.x1, m.y1 };
+                    if (m.type != dist_result || w.outstanding.empty() || t.x0 != w.outstanding.front().x0 ||
+                        t.y0 != w.outstanding.front().y0 || t.x1 != w.outstanding.front().x1 ||
+                        t.y1 != w.outstanding.front().y1)
+                    {
+                        drop(w, pending);
+                        continue;
+                    }
+                    estimates.resize(tile_pixels(t));
+                    if (!recv_all(w.fd, estimates.data(), estimates.size() * sizeof(pixel_estimate)))
+                    {
+                        drop(w, pending);
+                        continue;
+                    }
+                    w.outstanding.pop_front();
+                    on_result(t, estimates.data());
+                    spent += m.value;
+                    remaining--;
+                    worker_tiles[owner[p]]++;
+                }
+
+                if (listen_fd >= 0 && (polled.back().revents & POLLIN))
+                {
+                    int fd = accept(listen_fd, 0, 0);
+                    if (fd >= 0)
+                    {
+                        int yes = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                        workers.push_back(worker_link{ fd, hello_deadline() });
+                        worker_tiles.push_back(0);
+                    }
+                }
+            }
+
+            //let every worker go
+            tile none = { 0, 0, 0, 0 };
+            dist_message done = make_message(dist_done, none, 0);
+            for (size_t k = 0; k < workers.size(); k++)
+            {
+                if (workers[k].fd >= 0)
+                {
+                    send_all(workers[k].fd, &done, sizeof(done));
+                    close(workers[k].fd);
+                }
+            }
+            return spent;
+        }
+
+        int width, height;
+        int tile_size;
+        uint64_t fingerprint;
+        int workers_lost = 0;
+        int local_tiles = 0;             //tiles render_local did
+        std::vector<int> worker_tiles;   //tiles each worker sent back, in the order they connected
+
+        static const size_t in_flight = 2; //tiles queued per worker, so it never waits on the coordinator
+        static constexpr double hello_secs = 2;
+
+    private:
+        struct worker_link
+        {
+            int fd;
+            std::chrono::steady_clock::time_point hello_by; //dropped if it hasn't said hello by then
+            bool greeted = false;
+            std::deque<tile> outstanding;
+        };
+
+        static std::chrono::steady_clock::time_point hello_deadline()
+        {
+            return std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(hello_secs));
+        }
+
+        //closes a dead or misbehaving worker's socket and puts its tiles back at the front of the queue
+        void drop(worker_link& w, std::deque<tile>& pending)
+        {
+            if (w.greeted)
+            {
+                workers_lost++;
+            }
+            for (size_t k = w.outstanding.size(); k > 0; k--)
+            {
+                pending.push_front(w.outstanding[k - 1]);
+            }
+            w.outstanding.clear();
+            close(w.fd);
+            w.fd = -1;
+        }
+
+        std::vector<worker_link> workers;
+};
+
+#endif
@@ -0,0 +1,39 @@
+# renders the same image with forked workers and without any, which have to come out byte for byte the same
+# (every pixel's samples are seeded by the pixel, not by who renders it), and checks every worker did some of it
+#
+#   cmake -DRENDERER=path/to/SimpleRayTracer -DOUT_DIR=dir -P distributed_test.cmake
+
+foreach(var RENDERER OUT_DIR)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "distributed_test.cmake needs -D${var}=...")
+    endif()
+endforeach()
+
+set(local_image "${OUT_DIR}/distributed_local.ppm")
+set(workers_image "${OUT_DIR}/distributed_workers.ppm")
+
+execute_process(COMMAND "${RENDERER}" --samples 8 "${local_image}" RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "rendering without workers failed: ${result}")
+endif()
+
+execute_process(COMMAND "${RENDERER}" --samples 8 --workers 3 "${workers_image}" RESULT_VARIABLE result
+                ERROR_VARIABLE log)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "rendering with --workers 3 failed: ${result}\n${log}")
+endif()
+
+# the same image would come out if the coordinator had rendered it all itself, so check the workers did some
+if(NOT log MATCHES "by worker: ([0-9]+) ([0-9]+) ([0-9]+)\n")
+    message(FATAL_ERROR "no tile counts for 3 workers in:\n${log}")
+endif()
+foreach(k 1 2 3)
+    if(CMAKE_MATCH_${k} EQUAL 0)
+        message(FATAL_ERROR "worker ${k} rendered no tiles:\n${log}")
+    endif()
+endforeach()
+
+execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${local_image}" "${workers_image}" RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${workers_image} differs from ${local_image}")
+endif()
@@ -0,0 +1,65 @@
+/* framebuffer.h
+ * Defines the framebuffer class, which holds the rendered linear color of every pixel as floats
+ * it knows nothing about file formats; image_writer.h turns it into bytes
+ * pixels are addressed by (i, j) with j = 0 at the bottom row, matching the camera's v,
+ * so tiles can be filled in any order and from any thread
+ * it can also keep how noisy each pixel is, which is what the denoiser goes by
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+
+#include <vector>
+#include "vec3.h"
+#include "adaptive_sampling.h"
+
+class framebuffer
+{
+    public:
+        framebuffer(int w, int h) : width(w), height(h), rgb(size_t(w) * h * 3, 0.0f) {}
+
+        inline vec3 get(int i, int j) const
+        {
+            const float *p = pixel(i, j);
+            return vec3(p[0], p[1], p[2]);
+        }
+
+        inline void set(int i, int j, const vec3& c)
+        {
+            float *p = pixel(i, j);
+            p[0] = c[0]; p[1] = c[1]; p[2] = c[2];
+        }
+
+        //sets the pixel to the estimate's average, and keeps its variance if variance is being kept
+        inline void set(int i, int j, const pixel_estimate& est)
+        {
+            set(i, j, est.average());
+            if (!variance.empty())
+            {
+                variance[size_t(j) * width + i] = est.mean_variance();
+            }
+        }
+
+        //starts keeping the variance of every pixel's mean luminance, for the pixels set from here on
+        void keep_variance() { variance.assign(size_t(width) * height, INFINITY); }
+
+        inline void add(int i, int j, const vec3& c)
+        {
+            float *p = pixel(i, j);
+            p[0] += c[0]; p[1] += c[1]; p[2] += c[2];
+        }
+
+        //3 floats per pixel, rows from the bottom up
+        inline float *pixel(int i, int j) { return &rgb[(size_t(j) * width + i) * 3]; }
+        inline const float *pixel(int i, int j) const { return &rgb[(size_t(j) * width + i) * 3]; }
+
+        int width;
+        int height;
+        std::vector<float> rgb;
+        std::vector<float> variance; //one per pixel, empty unless keep_variance() was called
+};
+
+#endif
@@ -0,0 +1,35 @@
+/* hash.h
+ * Defines hash_bytes, a quick 64-bit hash used to tell whether a file or a set of settings changed
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef HASHH
+#define HASHH
+
+#include <stdint.h>
+#include <string.h>
+
+/* 64-bit FNV-1a, taken a word at a time with an extra shift to mix high bits down
+ * not cryptographic, just enough to notice a changed file
+ */
+uint64_t hash_bytes(const void *data, size_t n, uint64_t h = 14695981039346656037ull)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + k, 8);
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 32;
+    }
+    for (; k < n; k++)
+    {
+        h = (h ^ p[k]) * 1099511628211ull;
+    }
+    return h;
+}
+
+#endif
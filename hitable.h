@@ -9,22 +9,72 @@
 #ifndef HITABLEH
 #define HITABLEH
 
+#include <stdint.h>
 #include "ray.h"
+#include "aabb.h"
 
-class material; //lets compiler know pointer in hit_record is to a class
+class hitable;
 
+//the surface where a ray hit, for shading
 struct hit_record {
     float t; //t along ray
     vec3 p; //point on surface
     vec3 normal; //surface normal
-    material *mat_ptr;
+    uint32_t mat_id; //index into the scene's material table
+    const hitable *object; //the scene's object that was hit, for finding it again (among the lights, say)
+};
+
+/* what the search for the closest hit keeps while it goes: just how far along the ray and what was hit,
+ * so each closer hit it finds is a couple of stores instead of working out a point and normal to throw away
+ * object is the primitive itself, never a list or BVH holding it, and prim is whatever it needs to know
+ * which part of it was hit (a triangle of a mesh, a sphere of a batch)
+ */
+struct ray_hit {
+    float t;
+    const hitable *object;
+    uint32_t prim;
 };
 
 class hitable
 {
     public:
-        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
-        //"= 0" makes hit a pure virtual function, which means that it must be overridden by a subclass
+        /* finds the closest hit in (t_min, t_max), and only then writes h; h is left alone on a miss,
+         * so a container can pass the same one to each of its objects in turn with t_max shrunk to the best so far
+         */
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const = 0;
+        //"= 0" makes intersect a pure virtual function, which means that it must be overridden by a subclass
+
+        /* works out the surface at a hit that intersect() found on this object
+         * containers never end up as h.object, so they keep this one, which only passes t along
+         */
+        virtual void surface(const ray& r, const ray_hit& h, hit_record& rec) const
+        {
+            rec.t = h.t;
+        }
+
+        //the closest hit with its surface: the search, then the surface once for the one that won
+        bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+        {
+            ray_hit h;
+            if (!intersect(r, t_min, t_max, h))
+            {
+                return false;
+            }
+            h.object->surface(r, h, rec);
+            return true;
+        }
+
+        /* whether the ray hits anything at all in (t_min, t_max), for shadow rays, which don't care what or where
+         * this just finds the closest hit; things that hold many objects override it to stop at the first one
+         */
+        virtual bool occluded(const ray& r, float t_min, float t_max) const
+        {
+            ray_hit h;
+            return intersect(r, t_min, t_max, h);
+        }
+
+        //sets box to surround the object; returns false if the object has no finite bounds
+        virtual bool bounding_box(aabb& box) const = 0;
 };
 
 #endif
\ No newline at end of file
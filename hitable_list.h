@@ -11,37 +11,68 @@
 #define HITABLELISTH
 
 #include "hitable.h"
+#include "stats.h"
 
 class hitable_list: public hitable
 {
     public:
         hitable_list() {}
         hitable_list(hitable **l, int n) { list = l; list_size = n; }
-        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool bounding_box(aabb& box) const;
 
         hitable **list;
         int list_size;
 };
 
-bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+bool hitable_list::intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
 {
-    hit_record temp_rec;
     bool hit_anything = false;
     double closest_so_far = t_max;
+    STATS_COUNT(stat_list_hits);
 
     //for each hitable obj in list
     for (int i = 0; i < list_size; i++)
     {
-        //if this obj hits at a closer distance
-        if (list[i]->hit(r, t_min, closest_so_far, temp_rec))
+        //if this obj hits at a closer distance; it only writes h if it does, so there's nothing to copy
+        if (list[i]->intersect(r, t_min, closest_so_far, h))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = h.t;
         }
     }
 
     return hit_anything;
 }
 
+//stops at the first object in the way instead of going through the whole list
+bool hitable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+    STATS_COUNT(stat_list_hits);
+    for (int i = 0; i < list_size; i++)
+    {
+        if (list[i]->occluded(r, t_min, t_max))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hitable_list::bounding_box(aabb& box) const
+{
+    box = aabb();
+    for (int i = 0; i < list_size; i++)
+    {
+        aabb temp_box;
+        if (!list[i]->bounding_box(temp_box))
+        {
+            return false;
+        }
+        box.expand(temp_box);
+    }
+    return true;
+}
+
 #endif
\ No newline at end of file
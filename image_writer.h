@@ -0,0 +1,466 @@
+/* image_writer.h
+ * Defines image_output, which encodes a framebuffer into an image file,
+ * async_tile_writer, which does that encoding on a background thread,
+ * and frame_writer, which does it for each frame of a sequence into its own numbered file
+ * supported formats are binary PPM (P6), PFM (linear floats) and a raw tiled float dump
+ * every format has a fixed byte offset per pixel, so the output file is memory-mapped and
+ * finished tiles are encoded straight into it in whatever order they complete;
+ * if the target can't be mapped (e.g. "-" for stdout) the bytes are buffered and written at the end
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef IMAGEWRITERH
+#define IMAGEWRITERH
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "framebuffer.h"
+#include "render_scheduler.h"
+#include "stats.h"
+
+enum image_format
+{
+    format_ppm,  //binary P6, 8 bits per channel, gamma corrected
+    format_pfm,  //Portable FloatMap, linear 32-bit floats, rows bottom to top
+    format_tiles //raw dump: tiles_header, then each tile's linear floats, see below
+};
+
+/* header of the raw tiled format
+ * tiles are stored in row-major tile order starting from the bottom-left tile, each as
+ * tile_size * tile_size RGB floats, rows bottom to top; pixels past the image edge are 0
+ */
+struct tiles_header
+{
+    char magic[8]; //"RTTILES1"
+    uint32_t width, height;
+    uint32_t tile_size;
+    uint32_t tiles_x, tiles_y;
+    uint32_t channels;
+};
+
+//picks the format from the file extension: .pfm, .tiles, anything else is PPM
+image_format format_from_path(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot && strcmp(dot, ".pfm") == 0)
+    {
+        return format_pfm;
+    }
+    if (dot && strcmp(dot, ".tiles") == 0)
+    {
+        return format_tiles;
+    }
+    return format_ppm;
+}
+
+class image_output
+{
+    public:
+        /* opens path for a w x h image; "-" writes to stdout
+         * gamma applies the gamma-2 correction when encoding to 8-bit PPM; float formats stay linear
+         */
+        image_output(const char *path, int w, int h, image_format f, int tsize = 16, bool gamma = true)
+            : width(w), height(h), format(f), tile_size(tsize), gamma_correct(gamma)
+        {
+            std::string header = make_header();
+            header_size = header.size();
+            size_t total = header_size + body_size();
+
+            if (strcmp(path, "-") == 0)
+            {
+                fd = -1;
+                to_stdout = true;
+            }
+            else
+            {
+                fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (fd >= 0 && ftruncate(fd, total) == 0)
+                {
+                    void *m = mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    if (m != MAP_FAILED)
+                    {
+                        data = (uint8_t*)m;
+                        mapped = true;
+                    }
+                }
+            }
+
+            if (!mapped)
+            {
+                buffer.assign(total, 0);
+                data = buffer.data();
+            }
+            size = total;
+            memcpy(data, header.data(), header_size);
+            good = to_stdout || fd >= 0;
+        }
+
+        ~image_output() { finish(); }
+
+        //encodes the pixels of one tile; tiles that don't overlap can be written concurrently
+        void write_tile(const framebuffer& fb, const tile& t)
+        {
+            STATS_TIMER(timer_output);
+            for (int j = t.y0; j < t.y1; j++)
+            {
+                for (int i = t.x0; i < t.x1; i++)
+                {
+                    write_pixel(i, j, fb.pixel(i, j));
+                }
+            }
+        }
+
+        void write_all(const framebuffer& fb)
+        {
+            tile whole = { 0, 0, width, height };
+            write_tile(fb, whole);
+        }
+
+        //flushes everything out and closes the file; returns false if anything failed
+        bool finish()
+        {
+            if (finished)
+            {
+                return good;
+            }
+            finished = true;
+            STATS_TIMER(timer_output);
+
+            if (mapped)
+            {
+                good = munmap(data, size) == 0 && good;
+            }
+            else if (to_stdout)
+            {
+                good = fwrite(data, 1, size, stdout) == size && fflush(stdout) == 0;
+            }
+            else if (fd >= 0)
+            {
+                size_t done = 0;
+                while (done < size)
+                {
+                    ssize_t n = write(fd, data + done, size - done);
+                    if (n <= 0)
+                    {
+                        good = false;
+                        break;
+                    }
+                    done += n;
+                }
+            }
+
+            if (fd >= 0)
+            {
+                good = close(fd) == 0 && good;
+            }
+            return good;
+        }
+
+        inline bool ok() const { return good; }
+
+        int width, height;
+        image_format format;
+        int tile_size;
+        bool gamma_correct;
+
+    private:
+        std::string make_header() const
+        {
+            char text[64];
+            switch (format)
+            {
+                case format_pfm:
+                {
+                    //a negative scale means little-endian floats
+                    uint16_t probe = 1;
+                    bool little = *(uint8_t*)&probe == 1;
+                    snprintf(text, sizeof(text), "PF\n%d %d\n%s\n", width, height, little ? "-1.0" : "1.0");
+                    return text;
+                }
+                case format_tiles:
+                {
+                    tiles_header h;
+                    memcpy(h.magic, "RTTILES1", 8);
+                    h.width = width;
+                    h.height = height;
+                    h.tile_size = tile_size;
+                    h.tiles_x = tiles_x();
+                    h.tiles_y = tiles_y();
+                    h.channels = 3;
+                    return std::string((const char*)&h, sizeof(h));
+                }
+                default:
+                    snprintf(text, sizeof(text), "P6\n%d %d\n255\n", width, height);
+                    return text;
+            }
+        }
+
+        inline int tiles_x() const { return (width + tile_size - 1) / tile_size; }
+        inline int tiles_y() const { return (height + tile_size - 1) / tile_size; }
+
+        size_t body_size() const
+        {
+            switch (format)
+            {
+                case format_pfm: return size_t(width) * height * 3 * sizeof(float);
+                case format_tiles: return size_t(tiles_x()) * tiles_y() * tile_size * tile_size * 3 * sizeof(float);
+                default: return size_t(width) * height * 3;
+            }
+        }
+
+        inline void write_pixel(int i, int j, const float *c)
+        {
+            switch (format)
+            {
+                case format_pfm:
+                    memcpy(data + header_size + (size_t(j) * width + i) * 12, c, 12);
+                    break;
+                case format_tiles:
+                {
+                    size_t tile_index = size_t(j / tile_size) * tiles_x() + i / tile_size;
+                    size_t in_tile = size_t(j % tile_size) * tile_size + i % tile_size;
+                    memcpy(data + header_size + (tile_index * tile_size * tile_size + in_tile) * 12, c, 12);
+                    break;
+                }
+                default:
+                {
+                    //PPM rows go top to bottom
+                    uint8_t *out = data + header_size + (size_t(height - 1 - j) * width + i) * 3;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        float v = gamma_correct ? sqrtf(c[k]) : c[k];
+                        v = v < 0 ? 0 : (v > 1 ? 1 : v);
+                        out[k] = uint8_t(255.99 * v);
+                    }
+                    break;
+                }
+            }
+        }
+
+        int fd = -1;
+        bool to_stdout = false;
+        bool mapped = false;
+        bool finished = false;
+        bool good = false;
+        uint8_t *data = 0;
+        size_t size = 0;
+        size_t header_size = 0;
+        std::vector<uint8_t> buffer;
+};
+
+/* encodes finished tiles into an image_output on its own thread,
+ * so render threads only pay for a queue push
+ */
+class async_tile_writer
+{
+    public:
+        async_tile_writer(image_output& o, const framebuffer& f) : out(o), fb(f)
+        {
+            worker = std::thread([this]() { run(); });
+        }
+
+        ~async_tile_writer() { finish(); }
+
+        //queues a tile; its pixels must not change after this
+        void push(const tile& t)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending.push_back(t);
+            }
+            wake.notify_one();
+        }
+
+        //waits for every queued tile to be encoded
+        void finish()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (done)
+                {
+                    return;
+                }
+                done = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (true)
+            {
+                wake.wait(guard, [this]() { return done || !pending.empty(); });
+                if (pending.empty())
+                {
+                    return; //done, and nothing left to write
+                }
+
+                std::deque<tile> batch;
+                batch.swap(pending);
+                guard.unlock();
+                for (size_t k = 0; k < batch.size(); k++)
+                {
+                    out.write_tile(fb, batch[k]);
+                }
+                guard.lock();
+            }
+        }
+
+        image_output& out;
+        const framebuffer& fb;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::deque<tile> pending;
+        bool done = false;
+        std::thread worker;
+};
+
+/* turns path into frame's file name: a run of '#'s becomes the frame number padded to that many digits
+ * ("shot_####.ppm" -> "shot_0012.ppm"); without one, the number goes before the extension ("out.ppm" -> "out.0012.ppm")
+ */
+std::string numbered_path(const char *path, int frame)
+{
+    std::string p = path;
+    size_t hashes = p.find('#');
+    if (hashes != std::string::npos)
+    {
+        size_t width = p.find_first_not_of('#', hashes);
+        width = (width == std::string::npos ? p.size() : width) - hashes;
+        char digits[32];
+        snprintf(digits, sizeof(digits), "%0*d", int(width), frame);
+        return p.replace(hashes, width, digits);
+    }
+
+    char digits[32];
+    snprintf(digits, sizeof(digits), ".%04d", frame);
+    size_t dot = p.rfind('.');
+    size_t slash = p.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return p + digits;
+    }
+    return p.insert(dot, digits);
+}
+
+/* writes the frames of a sequence on a background thread, each into numbered_path(path, frame),
+ * while the next frame renders
+ * it owns a few framebuffers: take one with acquire(), render into it, and hand it back with submit();
+ * acquire() only waits if every buffer is still queued for writing
+ */
+class frame_writer
+{
+    public:
+        frame_writer(const char *p, int w, int h, int tsize, int num_buffers = 2)
+            : path(p), width(w), height(h), tile_size(tsize)
+        {
+            assert(tile_size >= 1);
+            for (int k = 0; k < num_buffers; k++)
+            {
+                buffers.emplace_back(w, h);
+                free_buffers.push_back(&buffers.back());
+            }
+            worker = std::thread([this]() { run(); });
+        }
+
+        ~frame_writer() { finish(); }
+
+        framebuffer& acquire()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]() { return !free_buffers.empty(); });
+            framebuffer *fb = free_buffers.back();
+            free_buffers.pop_back();
+            return *fb;
+        }
+
+        //queues fb, which came from acquire(), to be written as frame; its pixels must not change after this
+        void submit(framebuffer& fb, int frame)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending.push_back(std::make_pair(&fb, frame));
+            }
+            wake.notify_all();
+        }
+
+        //waits for every queued frame to be written; returns false if any of them couldn't be
+        bool finish()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (done)
+                {
+                    return good;
+                }
+                done = true;
+            }
+            wake.notify_all();
+            worker.join();
+            return good;
+        }
+
+        std::string path;
+        int width, height;
+        int tile_size;
+        std::vector<std::string> failed; //files that couldn't be written
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (true)
+            {
+                wake.wait(guard, [this]() { return done || !pending.empty(); });
+                if (pending.empty())
+                {
+                    return;
+                }
+
+                std::pair<framebuffer*, int> job = pending.front();
+                pending.pop_front();
+                guard.unlock();
+
+                std::string name = numbered_path(path.c_str(), job.second);
+                image_output out(name.c_str(), width, height, format_from_path(name.c_str()), tile_size);
+                out.write_all(*job.first);
+                bool ok = out.ok() && out.finish();
+
+                guard.lock();
+                if (!ok)
+                {
+                    good = false;
+                    failed.push_back(name);
+                }
+                free_buffers.push_back(job.first);
+                wake.notify_all();
+            }
+        }
+
+        std::deque<framebuffer> buffers; //a deque, so the framebuffers never move
+        std::vector<framebuffer*> free_buffers;
+        std::deque<std::pair<framebuffer*, int>> pending;
+        std::mutex lock;
+        std::condition_variable wake;
+        bool done = false;
+        bool good = true;
+        std::thread worker;
+};
+
+#endif
@@ -0,0 +1,254 @@
+/* lights.h
+ * Defines light_set, the emissive objects of a scene gathered up so the path tracer can aim rays at them
+ * (next-event estimation) instead of waiting for paths to hit them by chance
+ * spheres are sampled by the cone of directions they cover as seen from the shading point, so every
+ * sample lands on the side that can be seen; meshes by picking a triangle by area and a point on it
+ * which light gets a sample is chosen by how much light each gives off in total, radiance times area,
+ * so a big bright panel gets most of the shadow rays and a dim speck hardly any
+ * see Pharr, Jakob and Humphreys, "Physically Based Rendering", 3rd ed., ch 14
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef LIGHTSH
+#define LIGHTSH
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "float.h"
+#include "hitable.h"
+#include "material.h"
+#include "diffuse_light.h"
+#include "sphere.h"
+#include "mesh.h"
+#include "rng.h"
+
+//a point picked on a light, as seen from the shading point
+struct light_sample
+{
+    vec3 direction; //unit vector from the shading point toward the light
+    float distance; //along direction to the light
+    vec3 radiance;  //what the light gives off back toward the shading point
+    float pdf;      //per unit solid angle, including the chance of having picked this light
+};
+
+class light_set
+{
+    public:
+        /* gathers every sphere and mesh in objects whose material is a light
+         * (anything else that emits still shows up when paths hit it, it just can't be aimed at)
+         */
+        void build(const std::vector<hitable*>& objects, const std::vector<const material*>& materials)
+        {
+            lights.clear();
+            cdf.clear();
+            by_object.clear();
+            float total = 0;
+            for (size_t k = 0; k < objects.size(); k++)
+            {
+                light l;
+                if (const sphere *s = dynamic_cast<const sphere*>(objects[k]))
+                {
+                    if (s->radius <= 0 || materials[s->mat_id]->type != material_light)
+                    {
+                        continue; //bubbles face inward, so they light nothing outside them
+                    }
+                    l.ball = s;
+                    l.mat_id = s->mat_id;
+                    l.area = 4 * float(M_PI) * s->radius * s->radius;
+                }
+                else if (const mesh *m = dynamic_cast<const mesh*>(objects[k]))
+                {
+                    if (m->triangle_count() == 0 || materials[m->mat_id]->type != material_light)
+                    {
+                        continue;
+                    }
+                    l.surface = m;
+                    l.mat_id = m->mat_id;
+                    l.area = 0;
+                    for (uint32_t i = 0; i < m->triangle_count(); i++)
+                    {
+                        vec3 normal;
+                        float area;
+                        m->sample_triangle(i, 0, 0, normal, area);
+                        l.area += area;
+                        l.triangle_cdf.push_back(l.area);
+                    }
+                }
+                else
+                {
+                    continue;
+                }
+
+                l.mat = materials[l.mat_id];
+                vec3 radiance = static_cast<const diffuse_light*>(l.mat)->radiance;
+                float power = (0.2126f * radiance.r() + 0.7152f * radiance.g() + 0.0722f * radiance.b()) * l.area;
+                if (power <= 0)
+                {
+                    continue;
+                }
+                total += power;
+                cdf.push_back(total);
+                l.chance = power;
+                by_object[objects[k]] = uint32_t(lights.size());
+                lights.push_back(l);
+            }
+
+            for (size_t k = 0; k < lights.size(); k++)
+            {
+                lights[k].chance /= total;
+            }
+        }
+
+        void clear()
+        {
+            lights.clear();
+            cdf.clear();
+            by_object.clear();
+        }
+
+        inline bool empty() const { return lights.empty(); }
+        inline size_t size() const { return lights.size(); }
+
+        /* picks a point on one of the lights as seen from the point from, using four numbers from gen
+         * returns false if the point it picked can't light from (it's on a back face, or from is inside the light);
+         * the sample still counts toward the average, it just adds nothing
+         * doesn't check whether anything is in the way; that's the shadow ray's job
+         */
+        bool sample(const vec3& from, rng& gen, light_sample& ls) const
+        {
+            float pick = gen.next() * cdf.back();
+            size_t k = std::min(size_t(std::upper_bound(cdf.begin(), cdf.end(), pick) - cdf.begin()), lights.size() - 1);
+            const light& l = lights[k];
+            float u1 = gen.next(), u2 = gen.next();
+            hit_record rec;
+
+            if (l.ball)
+            {
+                //uniform over the cone from from that just holds the sphere
+                vec3 to = l.ball->center - from;
+                float d2 = to.squared_length();
+                float one_minus_cos_max;
+                if (!cone(d2, l.ball->radius, one_minus_cos_max))
+                {
+                    return false;
+                }
+                float cos_theta = 1 - u1 * one_minus_cos_max;
+                float sin_theta = sqrtf(fmaxf(0.0f, 1 - cos_theta * cos_theta));
+                float phi = 2 * float(M_PI) * u2;
+                vec3 w = vec3::scale(to, 1 / sqrtf(d2));
+                vec3 a = fabsf(w.x()) > 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0);
+                vec3 v = vec3::unit_vector(vec3::cross(w, a));
+                vec3 u = vec3::cross(w, v);
+                ls.direction = vec3::scale(u, sin_theta * cosf(phi)) + vec3::scale(v, sin_theta * sinf(phi)) +
+                               vec3::scale(w, cos_theta);
+                //right at the rim of the cone, rounding can make it just miss
+                if (!sphere::intersect_sphere(l.ball->center, l.ball->radius, ray(from, ls.direction), 0, MAXFLOAT,
+                                              ls.distance))
+                {
+                    return false;
+                }
+                sphere::sphere_surface(l.ball->center, l.ball->radius, l.mat_id, ray(from, ls.direction), ls.distance,
+                                       rec);
+                rec.object = l.ball;
+                ls.pdf = l.chance / (2 * float(M_PI) * one_minus_cos_max);
+            }
+            else
+            {
+                float pick_area = gen.next() * l.area;
+                uint32_t i = uint32_t(std::upper_bound(l.triangle_cdf.begin(), l.triangle_cdf.end(), pick_area) -
+                                      l.triangle_cdf.begin());
+                i = std::min(i, l.surface->triangle_count() - 1);
+                float area;
+                rec.p = l.surface->sample_triangle(i, u1, u2, rec.normal, area);
+                vec3 to = rec.p - from;
+                float d2 = to.squared_length();
+                ls.distance = sqrtf(d2);
+                ls.direction = vec3::scale(to, 1 / ls.distance);
+                float cos_light = -vec3::dot(ls.direction, rec.normal);
+                if (cos_light <= 0)
+                {
+                    return false;
+                }
+                rec.t = ls.distance;
+                rec.mat_id = l.mat_id;
+                rec.object = l.surface;
+                //uniform by area over the whole mesh, turned into a density per solid angle
+                ls.pdf = l.chance * d2 / (cos_light * l.area);
+            }
+
+            ls.radiance = l.mat->emitted(ray(from, ls.direction), rec);
+            return true;
+        }
+
+        /* the density sample() would have picked the light that r, from a shading point at its origin, hit at rec
+         * with; 0 if it isn't a light in the set, or sample() could never have picked it
+         * the light is found by the object rec says was hit
+         */
+        float pdf(const ray& r, const hit_record& rec) const
+        {
+            auto found = by_object.find(rec.object);
+            if (found == by_object.end())
+            {
+                return 0;
+            }
+            const light& l = lights[found->second];
+            vec3 from = r.origin();
+
+            if (l.ball)
+            {
+                float one_minus_cos_max;
+                if (!cone((l.ball->center - from).squared_length(), l.ball->radius, one_minus_cos_max))
+                {
+                    return 0;
+                }
+                return l.chance / (2 * float(M_PI) * one_minus_cos_max);
+            }
+
+            vec3 to = rec.p - from;
+            float d2 = to.squared_length();
+            float cos_light = -vec3::dot(to, rec.normal) / sqrtf(d2);
+            if (cos_light <= 0)
+            {
+                return 0;
+            }
+            return l.chance * d2 / (cos_light * l.area);
+        }
+
+    private:
+        struct light
+        {
+            const sphere *ball = 0;   //one of these two is set
+            const mesh *surface = 0;
+            const material *mat;
+            uint32_t mat_id;
+            float area;
+            float chance;                   //of being picked by sample()
+            std::vector<float> triangle_cdf; //running total of the mesh's triangle areas, in leaf order
+        };
+
+        /* 1 - cos of the half-angle of the cone from a point d2 away (squared) from the center of a sphere
+         * of the given radius, worked out without the cancellation 1 - sqrt(1 - sin^2) has for far, small spheres
+         * false if the point is inside the sphere
+         */
+        static inline bool cone(float d2, float radius, float& one_minus_cos_max)
+        {
+            float sin2 = radius * radius / d2;
+            if (sin2 >= 1)
+            {
+                return false;
+            }
+            one_minus_cos_max = sin2 / (1 + sqrtf(1 - sin2));
+            return true;
+        }
+
+        std::vector<light> lights;
+        std::vector<float> cdf; //running total of the lights' power
+        std::unordered_map<const hitable*, uint32_t> by_object; //index in lights of each object that is one
+};
+
+#endif
@@ -10,14 +10,27 @@
 #define MATERIALH
 
 #include "ray.h"
+#include "rng.h"
+#include "stats.h"
 
 //returns a random point in the unit sphere
-vec3 random_in_unit_sphere()
+vec3 random_in_unit_sphere(rng& gen)
 {
+    if (gen.low_discrepancy())
+    {
+        //a uniform point in the ball straight from three numbers: height and angle for the direction,
+        //cube root for the radius; folded into the octant the loop below lands in, which it always has
+        float z = 1 - 2 * gen.next();
+        float phi = 2 * float(M_PI) * gen.next();
+        float radius = cbrtf(gen.next());
+        float ring = radius * sqrtf(fmaxf(0.0f, 1 - z * z));
+        return vec3(-fabsf(ring * cosf(phi)), -fabsf(ring * sinf(phi)), -fabsf(radius * z));
+    }
+
     vec3 p;
     do //keep randomizing in unit cube until we get a point that's inside unit sphere
     {
-        p = vec3::scale((vec3(drand48(), drand48(), drand48()) - vec3(1, 1, 1)),
+        p = vec3::scale((vec3(gen.next(), gen.next(), gen.next()) - vec3(1, 1, 1)),
                         2.0);
     } while (p.squared_length() >= 1.0);
 
@@ -27,13 +40,48 @@ vec3 random_in_unit_sphere()
 //reflects v about n
 vec3 reflect(const vec3& v, const vec3& n)
 {
-    return v - vec3::scale(n, 2*vec3::dot(v, n));
+    return vec3::reflect(v, n);
 }
 
+//which concrete class a material is, so batches of one kind can be scattered without virtual calls
+enum material_type
+{
+    material_lambertian, material_metal, material_dielectric, material_light, material_other, material_type_count
+};
+
 class material
 {
     public:
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
+        material(material_type t = material_other) : type(t) {}
+
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, rng& gen) const = 0;
+
+        //light given off back along r_in where it hit; only lights give off any
+        virtual vec3 emitted(const ray& r_in, const hit_record& rec) const
+        {
+            return vec3(0, 0, 0);
+        }
+
+        /* for aiming paths at lights (next-event estimation): how much of the light arriving along direction
+         * (a unit vector away from the surface) scatter() sends back along r_in, cosine included,
+         * and in pdf the density, per unit solid angle, that scatter() picks direction with
+         * so a direction picked by scatter() has eval() / pdf == the attenuation it gives
+         * only meaningful for materials that aren't specular()
+         */
+        virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& direction, float& pdf) const
+        {
+            pdf = 0;
+            return vec3(0, 0, 0);
+        }
+
+        /* whether scatter() only sends light in directions of its own choosing, like a mirror or glass,
+         * so eval() has nothing to say about one picked anywhere else
+         * (fuzzy metal counts too: it has a density, just not one worth aiming shadow rays by)
+         * lights are never aimed at from a specular surface, only hit by chance
+         */
+        virtual bool specular() const { return true; }
+
+        material_type type;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,260 @@
+/* mesh.h
+ * Defines the mesh class, a triangle mesh stored as one shared vertex buffer and a 32-bit index buffer,
+ * so a million triangles are one object and a few flat arrays instead of a million hitables
+ * each mesh has its own bvh_tree over its triangles, with the indices kept in leaf order,
+ * and the scene's BVH just sees the mesh as one box
+ * the ray/triangle test is the watertight one of Woop, Benthin and Wald, "Watertight Ray/Triangle
+ * Intersection" (2013): a ray through an edge or vertex shared by two triangles hits at least one of them,
+ * so closed meshes have no cracks for paths to leak through
+ * a leaf's triangles are tested together in plain loops over lanes, so the compiler can vectorize them
+ * the whole mesh has one material, and its normals are the triangles' own, facing the side
+ * the vertices are wound counter-clockwise around, as OBJ files have them
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef MESHH
+#define MESHH
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "hitable.h"
+#include "bvh.h"
+#include "stats.h"
+
+class mesh: public hitable
+{
+    public:
+        /* takes over the vertex positions (x, y, z each) and triangle indices (three each) and builds the tree,
+         * on up to num_threads threads (0 = every hardware thread)
+         * every index has to be less than the number of vertices
+         */
+        mesh(std::vector<float> pos, std::vector<uint32_t> idx, uint32_t m, int num_threads = 0)
+            : positions(std::move(pos)), indices(std::move(idx)), mat_id(m)
+        {
+            uint32_t n = triangle_count();
+            std::vector<aabb> boxes(n);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    boxes[i].expand(vertex(indices[i * 3 + c]));
+                }
+            }
+            tree.build(boxes, num_threads);
+
+            //put the triangles in leaf order so each leaf is a contiguous run of indices
+            std::vector<uint32_t> ordered(indices.size());
+            for (uint32_t i = 0; i < n; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    ordered[i * 3 + c] = indices[tree.prim_order[i] * 3 + c];
+                }
+            }
+            indices.swap(ordered);
+        }
+
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
+        {
+            triangle_ray tr(r);
+            uint32_t closest_triangle = 0;
+            bool hit_anything = tree.traverse(r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, float& closest_so_far)
+                {
+                    bool found = false;
+                    for (uint32_t i = first; i < first + count; i += lanes)
+                    {
+                        int lane = closest_hit(tr, i, std::min(uint32_t(lanes), first + count - i), t_min,
+                                               closest_so_far);
+                        if (lane >= 0)
+                        {
+                            closest_triangle = i + lane;
+                            found = true;
+                        }
+                    }
+                    return found;
+                });
+            if (!hit_anything)
+            {
+                return false;
+            }
+            h.t = t_max;
+            h.object = this;
+            h.prim = closest_triangle;
+            return true;
+        }
+
+        virtual void surface(const ray& r, const ray_hit& h, hit_record& rec) const
+        {
+            const uint32_t *tri = &indices[h.prim * 3];
+            vec3 v0 = vertex(tri[0]);
+            rec.t = h.t;
+            rec.p = r.point_at_t(h.t);
+            rec.normal = vec3::unit_vector(vec3::cross(vertex(tri[1]) - v0, vertex(tri[2]) - v0));
+            rec.mat_id = mat_id;
+            rec.object = this;
+        }
+
+        //any triangle in the way will do, so it stops at the first leaf with one
+        virtual bool occluded(const ray& r, float t_min, float t_max) const
+        {
+            triangle_ray tr(r);
+            return tree.traverse_any(r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, float& t)
+                {
+                    for (uint32_t i = first; i < first + count; i += lanes)
+                    {
+                        if (closest_hit(tr, i, std::min(uint32_t(lanes), first + count - i), t_min, t) >= 0)
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+        }
+
+        /* picks a point uniformly by area on triangle k (in leaf order), from two numbers in [0, 1),
+         * with the triangle's unit normal and area
+         */
+        inline vec3 sample_triangle(uint32_t k, float u1, float u2, vec3& normal, float& area) const
+        {
+            const uint32_t *tri = &indices[k * 3];
+            vec3 v0 = vertex(tri[0]), e1 = vertex(tri[1]) - v0, e2 = vertex(tri[2]) - v0;
+            vec3 c = vec3::cross(e1, e2);
+            float length = c.length();
+            normal = vec3::scale(c, 1 / length);
+            area = 0.5f * length;
+            //folding the unit square onto the triangle with a square root keeps the density even
+            float s = sqrtf(u1);
+            return v0 + vec3::scale(e1, s * (1 - u2)) + vec3::scale(e2, s * u2);
+        }
+
+        virtual bool bounding_box(aabb& box) const
+        {
+            box = tree.bounds();
+            return !tree.nodes.empty();
+        }
+
+        inline uint32_t triangle_count() const { return uint32_t(indices.size() / 3); }
+
+        inline vec3 vertex(uint32_t v) const
+        {
+            return vec3(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+        }
+
+        std::vector<float> positions;  //x, y, z of each vertex
+        std::vector<uint32_t> indices; //three vertices per triangle, in BVH leaf order
+        uint32_t mat_id;
+        bvh_tree tree;
+
+        static const int lanes = 4; //triangles tested at once, one whole leaf of bvh_tree
+
+    private:
+        /* what the watertight test works out once per ray: the ray's largest axis becomes z,
+         * and a shear maps its direction to (0, 0, 1), so each triangle only needs its 2D edge functions
+         * about the origin, and which side of all three edges that is
+         */
+        struct triangle_ray
+        {
+            triangle_ray(const ray& r)
+            {
+                vec3 dir = r.direction();
+                vec3 origin = r.origin();
+                float ax = fabsf(dir[0]), ay = fabsf(dir[1]), az = fabsf(dir[2]);
+                kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+                kx = (kz + 1) % 3;
+                ky = (kx + 1) % 3;
+                if (dir[kz] < 0)
+                {
+                    std::swap(kx, ky); //keeps the winding, and so the sign of the edge functions, the same
+                }
+                sx = dir[kx] / dir[kz];
+                sy = dir[ky] / dir[kz];
+                sz = 1.0f / dir[kz];
+                for (int a = 0; a < 3; a++)
+                {
+                    org[a] = origin[a];
+                }
+            }
+
+            int kx, ky, kz;
+            float sx, sy, sz;
+            float org[3];
+        };
+
+        /* tests triangles first to first + count - 1 (count <= lanes) against the ray,
+         * returns the lane of the closest hit in (t_min, closest_so_far) and shrinks closest_so_far to it,
+         * or -1 if none of them is closer
+         */
+        int closest_hit(const triangle_ray& tr, uint32_t first, uint32_t count, float t_min,
+                        float& closest_so_far) const
+        {
+            //vertices relative to the ray origin, in the ray's axes; spare lanes repeat the last triangle
+            float px[3][lanes], py[3][lanes], pz[3][lanes];
+            for (int l = 0; l < lanes; l++)
+            {
+                const uint32_t *tri = &indices[(first + std::min(uint32_t(l), count - 1)) * 3];
+                for (int c = 0; c < 3; c++)
+                {
+                    const float *v = &positions[tri[c] * 3];
+                    pz[c][l] = v[tr.kz] - tr.org[tr.kz];
+                    px[c][l] = v[tr.kx] - tr.org[tr.kx] - tr.sx * pz[c][l];
+                    py[c][l] = v[tr.ky] - tr.org[tr.ky] - tr.sy * pz[c][l];
+                }
+            }
+            STATS_ADD(stat_triangle_tests, count);
+
+            //edge functions: which side of each edge the ray passes, scaled by the triangle's projected area
+            float u[lanes], v[lanes], w[lanes];
+            for (int l = 0; l < lanes; l++)
+            {
+                u[l] = px[2][l] * py[1][l] - py[2][l] * px[1][l];
+                v[l] = px[0][l] * py[2][l] - py[0][l] * px[2][l];
+                w[l] = px[1][l] * py[0][l] - py[1][l] * px[0][l];
+            }
+            //a ray exactly on an edge gets an edge function of 0 in float, which could be the wrong side of it;
+            //doubles get it right, and it's rare enough to not cost anything
+            for (uint32_t l = 0; l < count; l++)
+            {
+                if (u[l] == 0 || v[l] == 0 || w[l] == 0)
+                {
+                    u[l] = float(double(px[2][l]) * py[1][l] - double(py[2][l]) * px[1][l]);
+                    v[l] = float(double(px[0][l]) * py[2][l] - double(py[0][l]) * px[2][l]);
+                    w[l] = float(double(px[1][l]) * py[0][l] - double(py[1][l]) * px[0][l]);
+                }
+            }
+
+            float t[lanes];
+            int inside[lanes];
+            for (int l = 0; l < lanes; l++)
+            {
+                //hit if the ray is on the same side of all three edges, whichever way the triangle faces
+                float det = u[l] + v[l] + w[l];
+                inside[l] = ((u[l] >= 0 && v[l] >= 0 && w[l] >= 0) || (u[l] <= 0 && v[l] <= 0 && w[l] <= 0)) &&
+                            det != 0;
+                t[l] = (u[l] * pz[0][l] + v[l] * pz[1][l] + w[l] * pz[2][l]) * tr.sz / det;
+            }
+
+            int closest = -1;
+            for (uint32_t l = 0; l < count; l++)
+            {
+                if (inside[l] && t[l] > t_min && t[l] < closest_so_far)
+                {
+                    closest_so_far = t[l];
+                    closest = int(l);
+                }
+            }
+            if (closest >= 0)
+            {
+                STATS_COUNT(stat_triangle_hits);
+            }
+            return closest;
+        }
+};
+
+#endif
@@ -15,13 +15,14 @@
 class metal: public material
 {
     public:
-        metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
+        metal(const vec3& a, float f) : material(material_metal), albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, rng& gen) const
         {
+            STATS_COUNT(stat_scatter_metal);
             //reflect incoming ray about surface normal
             vec3 reflected = reflect(vec3::unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + vec3::scale(random_in_unit_sphere(), fuzz));
+            scattered = ray(rec.p, reflected + vec3::scale(random_in_unit_sphere(gen), fuzz));
             attenuation = albedo;
             return vec3::dot(scattered.direction(), rec.normal) > 0;
         }
@@ -0,0 +1,86 @@
+/* plane.h
+ * Defines the plane class, an infinite flat surface through a point, facing along its normal
+ * the test is one dot product and a division, where a huge sphere standing in for a floor costs a
+ * full quadratic on every ray; but it has no bounds, so it can't go in a BVH (see scene::build)
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef PLANEH
+#define PLANEH
+
+#include "hitable.h"
+#include "stats.h"
+
+class plane: public hitable
+{
+    public:
+        plane() {}
+        plane(vec3 p, vec3 n, uint32_t m) : point(p), normal(n), mat_id(m) {}; //n has to be unit length
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const;
+        virtual void surface(const ray& r, const ray_hit& h, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+
+        //the intersection itself, for code that keeps planes as plain structs instead of plane objects
+        static bool intersect_plane(const vec3& point, const vec3& normal, const ray& r, float t_min, float t_max,
+                                    float& t);
+        static void plane_surface(const vec3& normal, uint32_t mat_id, const ray& r, float t, hit_record& rec);
+
+        vec3 point;
+        vec3 normal; //unit length; the side it points to is the outside, like a sphere's
+        uint32_t mat_id;
+};
+
+bool plane::intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
+{
+    float t;
+    if (!intersect_plane(point, normal, r, t_min, t_max, t))
+    {
+        return false;
+    }
+    h.t = t;
+    h.object = this;
+    h.prim = 0;
+    return true;
+}
+
+void plane::surface(const ray& r, const ray_hit& h, hit_record& rec) const
+{
+    plane_surface(normal, mat_id, r, h.t, rec);
+    rec.object = this;
+}
+
+inline bool plane::intersect_plane(const vec3& point, const vec3& normal, const ray& r, float t_min, float t_max,
+                                   float& t)
+{
+    STATS_COUNT(stat_plane_tests);
+    float denom = vec3::dot(normal, r.direction());
+    if (denom == 0) //parallel to the plane
+    {
+        return false;
+    }
+    float temp = vec3::dot(point - r.origin(), normal) / denom;
+    if (temp < t_max && temp > t_min)
+    {
+        t = temp;
+        return true;
+    }
+    return false;
+}
+
+void plane::plane_surface(const vec3& normal, uint32_t mat_id, const ray& r, float t, hit_record& rec)
+{
+    rec.t = t;
+    rec.p = r.point_at_t(t);
+    rec.normal = normal;
+    rec.mat_id = mat_id;
+}
+
+//no finite box holds it
+bool plane::bounding_box(aabb& box) const
+{
+    return false;
+}
+
+#endif
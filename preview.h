@@ -0,0 +1,281 @@
+/* preview.h
+ * An interactive preview for look development: instead of one long render, the view is traced in
+ * passes that start coarse and get finer, each one published to a memory-mapped file as soon as it's done
+ * the first pass traces one sample per 4 x 4 block of pixels, then 2 x 2, then every pixel, and from then
+ * on every pixel's sample count doubles each pass until the render's sample count is reached
+ * a viewer polls the file (see preview_header for how to read it without catching a frame half-copied);
+ * commands on stdin move the camera or reload the scene, and the passes in flight give up on the old view
+ * within a tile: each render thread checks for a change before it starts a tile
+ * the full-resolution passes are render_tile_pass() on one accumulation buffer, so a preview left to
+ * finish gives exactly the image the progressive render would
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef PREVIEWH
+#define PREVIEWH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "renderer.h"
+#include "progressive.h"
+#include "framebuffer.h"
+#include "render_scheduler.h"
+
+const uint32_t preview_version = 1;
+
+/* the start of a preview file; width * height * 3 floats follow it, linear rgb, rows from the bottom up
+ * like framebuffer's; passes coarser than full resolution are blown up to it, each block one color
+ * sequence is a seqlock: it's odd while a frame is being copied in and goes up by 2 with every frame,
+ * so a reader copies the pixels between two reads of an even sequence and keeps them if both match
+ */
+struct preview_header
+{
+    char magic[8];          //"RTPREVW1"
+    uint32_t version;       //preview_version
+    uint32_t header_size;   //sizeof(preview_header); the pixels start right after
+    uint32_t width, height;
+    uint64_t sequence;
+    uint32_t view;          //goes up whenever the camera or scene changes, so a viewer can tell a new view from a finer one
+    uint32_t scale;         //pixels per side of the blocks the frame was traced in; 1 = every pixel
+    uint32_t samples;       //per pixel (or block) in the frame
+    uint32_t done;          //1 once the view has every sample it's going to get
+};
+
+//the preview file, mapped shared so a viewer sees every frame published without it being written out
+class preview_output
+{
+    public:
+        preview_output(const char *path, int w, int h) : width(w), height(h)
+        {
+            size = sizeof(preview_header) + size_t(w) * h * 3 * sizeof(float);
+            int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+            {
+                return;
+            }
+            if (ftruncate(fd, size) == 0)
+            {
+                void *m = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (m != MAP_FAILED)
+                {
+                    header = (preview_header*)m;
+                    pixels = (float*)(header + 1);
+                }
+            }
+            close(fd);
+            if (header)
+            {
+                //ftruncate zeroed the file, so the sequence starts at 0: no frame yet, but none being copied either
+                memcpy(header->magic, "RTPREVW1", 8);
+                header->version = preview_version;
+                header->header_size = sizeof(preview_header);
+                header->width = w;
+                header->height = h;
+            }
+        }
+
+        ~preview_output()
+        {
+            if (header)
+            {
+                munmap(header, size);
+            }
+        }
+
+        preview_output(const preview_output&) = delete;
+        preview_output& operator=(const preview_output&) = delete;
+
+        inline bool ok() const { return header != 0; }
+
+        //copies fb into the file as the newest frame of the given view
+        void publish(const framebuffer& fb, uint32_t view, int scale, int samples, bool done)
+        {
+            uint64_t seq = header->sequence;
+            __atomic_store_n(&header->sequence, seq + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE); //nothing below can be seen before the odd sequence
+            header->view = view;
+            header->scale = scale;
+            header->samples = samples;
+            header->done = done;
+            memcpy(pixels, fb.rgb.data(), fb.rgb.size() * sizeof(float));
+            __atomic_store_n(&header->sequence, seq + 2, __ATOMIC_RELEASE);
+        }
+
+        int width;
+        int height;
+
+    private:
+        size_t size;
+        preview_header *header = 0;
+        float *pixels = 0;
+};
+
+/* reads commands for the preview from a file descriptor (normally stdin) on a thread of its own,
+ * one per line, and queues them for the render loop to apply between views
+ * every line counts as a change, which is what the render threads check to give up on the current view
+ */
+class preview_commands
+{
+    public:
+        preview_commands(int fd) : state(std::make_shared<shared>())
+        {
+            FILE *input = fdopen(dup(fd), "r");
+            if (!input)
+            {
+                state->closed = true;
+                return;
+            }
+            //the thread keeps its own reference, since it can't be stopped while it's blocked reading
+            //and so is left to go when the process does
+            std::shared_ptr<shared> s = state;
+            std::thread([s, input]() { s->read_all(input); }).detach();
+        }
+
+        inline uint64_t changes() const { return state->change_count.load(std::memory_order_relaxed); }
+
+        //takes the oldest queued command; false if there's none
+        bool next(std::string& command)
+        {
+            std::lock_guard<std::mutex> guard(state->lock);
+            if (state->queue.empty())
+            {
+                return false;
+            }
+            command = state->queue.front();
+            state->queue.pop_front();
+            return true;
+        }
+
+        //waits until there's a change past seen or the input has ended; returns false for the latter
+        bool wait(uint64_t seen)
+        {
+            std::unique_lock<std::mutex> guard(state->lock);
+            state->arrived.wait(guard, [&]() { return changes() != seen || state->closed; });
+            return changes() != seen;
+        }
+
+    private:
+        struct shared
+        {
+            void read_all(FILE *input)
+            {
+                char line[4096];
+                while (fgets(line, sizeof(line), input))
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    queue.push_back(line);
+                    change_count++;
+                    arrived.notify_all();
+                }
+                fclose(input);
+                std::lock_guard<std::mutex> guard(lock);
+                closed = true;
+                arrived.notify_all();
+            }
+
+            std::mutex lock;
+            std::condition_variable arrived;
+            std::deque<std::string> queue;
+            std::atomic<uint64_t> change_count{0};
+            bool closed = false;
+        };
+
+        std::shared_ptr<shared> state;
+};
+
+/* traces sample 0 of one pixel in every scale x scale block whose bottom left corner is in the tile,
+ * jittered anywhere in the block, and fills the whole block with it
+ * a block can reach past the tile it starts in, but the blocks split the image between them,
+ * so no two tiles ever write the same pixel
+ */
+void render_tile_blocks(const tile& t, const scene& sc, const camera& cam, const render_settings& rs, int scale,
+                        framebuffer& fb)
+{
+    int y_start = (t.y0 + scale - 1) / scale * scale;
+    int x_start = (t.x0 + scale - 1) / scale * scale;
+    for (int j = y_start; j < t.y1; j += scale)
+    {
+        for (int i = x_start; i < t.x1; i += scale)
+        {
+            rng gen(j * rs.width + i, 0, rs.source);
+            float u = float(i + scale * gen.next()) / float(rs.width);
+            float v = float(j + scale * gen.next()) / float(rs.height);
+            vec3 c = color(cam.get_ray(u, v, gen), sc, rs.path, gen);
+            for (int y = j; y < std::min(j + scale, rs.height); y++)
+            {
+                for (int x = i; x < std::min(i + scale, rs.width); x++)
+                {
+                    fb.set(x, y, c);
+                }
+            }
+        }
+    }
+}
+
+/* renders one view for the preview, publishing every pass: coarse blocks from first_scale down, then
+ * full-resolution passes into acc (which has to start empty) doubling the samples up to rs's maximum
+ * stop() is checked before every tile, and once it says so the view is given up: the pass in flight
+ * isn't published and this returns false; it returns true once the last pass is out
+ * published(scale, samples) is called after each pass is out
+ */
+template <typename S, typename P>
+bool render_preview(render_scheduler& scheduler, const scene& sc, const camera& cam, const render_settings& rs,
+                    int first_scale, accumulation_buffer& acc, framebuffer& fb, preview_output& out, uint32_t view,
+                    S stop, P published)
+{
+    std::atomic<bool> stopped{false};
+    auto run_pass = [&](auto trace)
+    {
+        scheduler.run([&](const tile& t, int thread_id)
+        {
+            if (stopped.load(std::memory_order_relaxed) || stop())
+            {
+                stopped.store(true, std::memory_order_relaxed); //the rest of the tiles are skipped as they come up
+                return;
+            }
+            trace(t);
+        });
+        return !stopped.load();
+    };
+
+    for (int scale = first_scale; scale > 1; scale /= 2)
+    {
+        if (!run_pass([&](const tile& t) { render_tile_blocks(t, sc, cam, rs, scale, fb); }))
+        {
+            return false;
+        }
+        out.publish(fb, view, scale, 1, false);
+        published(scale, 1);
+    }
+
+    int max_samples = rs.sampling.max_samples;
+    for (int target = 1; ; target = std::min(target * 2, max_samples))
+    {
+        if (!run_pass([&](const tile& t) { render_tile_pass(t, sc, cam, rs, acc, target, fb); }))
+        {
+            return false;
+        }
+        out.publish(fb, view, 1, target, target == max_samples);
+        published(1, target);
+        if (target == max_samples)
+        {
+            return true;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,235 @@
+/* progressive.h
+ * Progressive rendering: the image is rendered in passes, each taking every pixel a few samples further,
+ * with the running per-pixel estimates checkpointed to disk between passes so a long render
+ * that gets killed can pick up where it left off
+ * every pixel's samples are still taken and summed in order (sample s uses rng(pixel, s)),
+ * so any number of passes, with or without a resume in between, gives the same image as render_tile()
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef PROGRESSIVEH
+#define PROGRESSIVEH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "renderer.h"
+#include "adaptive_sampling.h"
+#include "framebuffer.h"
+#include "render_scheduler.h"
+#include "hash.h"
+
+//every pixel's running estimate: what a render has to carry from one pass to the next
+class accumulation_buffer
+{
+    public:
+        accumulation_buffer(int w, int h) : width(w), height(h), pixels(size_t(w) * h) {}
+
+        inline pixel_estimate& at(int i, int j) { return pixels[size_t(j) * width + i]; }
+
+        int width;
+        int height;
+        std::vector<pixel_estimate> pixels;
+};
+
+/* takes each pixel of the tile up to target samples (fewer once adaptive sampling says it's done),
+ * and writes its current average to fb; returns the number of samples taken
+ */
+uint64_t render_tile_pass(const tile& t, const scene& sc, const camera& cam, const render_settings& rs,
+                          accumulation_buffer& acc, int target, framebuffer& fb)
+{
+    uint64_t spent = 0;
+    for (int j = t.y0; j < t.y1; j++)
+    {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+            pixel_estimate& est = acc.at(i, j);
+            int before = est.n;
+            while (est.n < target && !est.done(rs.sampling))
+            {
+                est.add(sample_pixel(i, j, est.n, sc, cam, rs));
+            }
+            fb.set(i, j, est);
+            spent += est.n - before;
+        }
+    }
+    return spent;
+}
+
+const uint32_t checkpoint_version = 1;
+
+/* a checkpoint file is this header followed by width * height pixel_estimates, rows bottom up
+ * fingerprint is a hash of everything that changes the image (scene, camera, resolution, sampling),
+ * so a checkpoint can't be resumed into a different render
+ */
+struct checkpoint_header
+{
+    char magic[8];          //"RTCHKPT1"
+    uint32_t version;       //checkpoint_version
+    uint32_t estimate_size; //sizeof(pixel_estimate)
+    uint32_t width, height;
+    uint32_t passes_done;
+    uint32_t reserved;
+    uint64_t fingerprint;
+    uint64_t data_hash;     //hash_bytes of the estimates
+};
+
+/* writes checkpoints on a background thread, so render threads only wait for a copy of the estimates
+ * if a new checkpoint comes in while the last one is still being written, only the newest is kept
+ * each file is written under a temporary name, synced, then renamed over the old one,
+ * so a crash mid-write still leaves the previous checkpoint intact
+ */
+class checkpoint_writer
+{
+    public:
+        checkpoint_writer(const std::string& p, uint64_t fp) : path(p), fingerprint(fp)
+        {
+            worker = std::thread([this]() { run(); });
+        }
+
+        ~checkpoint_writer() { finish(); }
+
+        //queues a copy of acc, which has passes_done passes finished
+        void save(const accumulation_buffer& acc, int passes_done)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending = acc.pixels;
+                pending_width = acc.width;
+                pending_height = acc.height;
+                pending_passes = passes_done;
+                has_pending = true;
+            }
+            wake.notify_one();
+        }
+
+        //waits for the last queued checkpoint to be written; returns false if any write failed
+        bool finish()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (done)
+                {
+                    return good;
+                }
+                done = true;
+            }
+            wake.notify_one();
+            worker.join();
+            return good;
+        }
+
+        std::string path;
+        uint64_t fingerprint;
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (true)
+            {
+                wake.wait(guard, [this]() { return done || has_pending; });
+                if (!has_pending)
+                {
+                    return;
+                }
+
+                std::vector<pixel_estimate> snapshot;
+                snapshot.swap(pending);
+                checkpoint_header h;
+                memset(&h, 0, sizeof(h));
+                memcpy(h.magic, "RTCHKPT1", 8);
+                h.version = checkpoint_version;
+                h.estimate_size = sizeof(pixel_estimate);
+                h.width = pending_width;
+                h.height = pending_height;
+                h.passes_done = pending_passes;
+                h.fingerprint = fingerprint;
+                has_pending = false;
+                guard.unlock();
+
+                h.data_hash = hash_bytes(snapshot.data(), snapshot.size() * sizeof(pixel_estimate));
+                bool ok = write_file(h, snapshot);
+
+                guard.lock();
+                good = ok && good;
+            }
+        }
+
+        bool write_file(const checkpoint_header& h, const std::vector<pixel_estimate>& data) const
+        {
+            std::string temp_path = path + ".tmp";
+            FILE *f = fopen(temp_path.c_str(), "wb");
+            if (!f)
+            {
+                return false;
+            }
+            bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+                      fwrite(data.data(), sizeof(pixel_estimate), data.size(), f) == data.size() &&
+                      fflush(f) == 0 && fsync(fileno(f)) == 0;
+            ok = fclose(f) == 0 && ok;
+            ok = ok && rename(temp_path.c_str(), path.c_str()) == 0;
+            if (!ok)
+            {
+                unlink(temp_path.c_str());
+            }
+            return ok;
+        }
+
+        std::mutex lock;
+        std::condition_variable wake;
+        std::vector<pixel_estimate> pending;
+        int pending_width = 0, pending_height = 0, pending_passes = 0;
+        bool has_pending = false;
+        bool done = false;
+        bool good = true;
+        std::thread worker;
+};
+
+/* reads the checkpoint at path into acc and sets passes_done
+ * fails with the reason in error if the file is missing, damaged, or from a render with another fingerprint
+ */
+bool load_checkpoint(const char *path, uint64_t fingerprint, accumulation_buffer& acc, int& passes_done,
+                     std::string& error)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        error = std::string("no checkpoint at ") + path;
+        return false;
+    }
+
+    checkpoint_header h;
+    std::vector<pixel_estimate> data(acc.pixels.size());
+    bool read = fread(&h, sizeof(h), 1, f) == 1;
+    bool matches = read && memcmp(h.magic, "RTCHKPT1", 8) == 0 && h.version == checkpoint_version &&
+                   h.estimate_size == sizeof(pixel_estimate);
+    if (matches && (h.fingerprint != fingerprint || int(h.width) != acc.width || int(h.height) != acc.height))
+    {
+        fclose(f);
+        error = std::string(path) + " is from a render with different settings";
+        return false;
+    }
+    read = matches && fread(data.data(), sizeof(pixel_estimate), data.size(), f) == data.size() && fgetc(f) == EOF;
+    fclose(f);
+    if (!read || h.data_hash != hash_bytes(data.data(), data.size() * sizeof(pixel_estimate)))
+    {
+        error = std::string(path) + " isn't a valid checkpoint";
+        return false;
+    }
+
+    acc.pixels.swap(data);
+    passes_done = int(h.passes_done);
+    return true;
+}
+
+#endif
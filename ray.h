@@ -18,7 +18,7 @@ class ray
         ray(const vec3& a, const vec3& b) { A = a; B = b; }
         vec3 origin() const { return A; }
         vec3 direction() const { return B; }
-        vec3 point_at_t(float t) const { return A + vec3::scale(B, t); }
+        vec3 point_at_t(float t) const { return vec3::mul_add(A, B, t); }
 
         vec3 A; //ray origin
         vec3 B; //ray direction
@@ -0,0 +1,41 @@
+/* ray_packet.h
+ * Defines the ray_packet struct, a group of N rays traced through the scene together
+ * neighboring camera rays go through nearly the same BVH nodes, so testing each node
+ * once for the whole packet saves most of the per-ray traversal work
+ * the rays are stored as separate x/y/z arrays so per-lane loops vectorize,
+ * and a bitmask marks which lanes hold a live ray
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef RAYPACKETH
+#define RAYPACKETH
+
+#include <stdint.h>
+#include "ray.h"
+
+template <int N>
+struct ray_packet
+{
+    static_assert(N > 0 && N <= 32, "packet lanes must fit in the 32-bit active mask");
+
+    inline void set(int lane, const ray& r)
+    {
+        ox[lane] = r.origin().x(); oy[lane] = r.origin().y(); oz[lane] = r.origin().z();
+        dx[lane] = r.direction().x(); dy[lane] = r.direction().y(); dz[lane] = r.direction().z();
+        active |= 1u << lane;
+    }
+
+    inline ray get(int lane) const
+    {
+        return ray(vec3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]));
+    }
+
+    //zeroed, since the per-lane loops run over every lane, empty ones too, and only mask them out afterwards
+    float ox[N] = {}, oy[N] = {}, oz[N] = {};
+    float dx[N] = {}, dy[N] = {}, dz[N] = {};
+    uint32_t active = 0; //bit l is set if lane l holds a ray
+};
+
+#endif
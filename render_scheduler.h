@@ -0,0 +1,215 @@
+/* render_scheduler.h
+ * Defines the render_scheduler class, which splits the image into tiles
+ * and renders them across a pool of threads
+ * each thread starts with its own queue of tiles and steals from the others once
+ * it runs dry, so threads stuck on expensive tiles (glass, metal) don't hold up the rest
+ * the threads are started on the first run and kept waiting between runs, so rendering
+ * frame after frame doesn't pay for starting them every time
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef RENDERSCHEDULERH
+#define RENDERSCHEDULERH
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "stats.h"
+
+//a rectangular block of pixels covering [x0, x1) x [y0, y1)
+struct tile
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+//a queue of tiles owned by one thread
+//the owner pops from the back, thieves take from the front
+class tile_queue
+{
+    public:
+        void push(const tile& t)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tiles.push_back(t);
+        }
+
+        bool pop(tile& t)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tiles.empty())
+            {
+                return false;
+            }
+            t = tiles.back();
+            tiles.pop_back();
+            return true;
+        }
+
+        bool steal(tile& t)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tiles.empty())
+            {
+                return false;
+            }
+            t = tiles.front();
+            tiles.pop_front();
+            return true;
+        }
+
+        std::mutex lock;
+        std::deque<tile> tiles;
+};
+
+class render_scheduler
+{
+    public:
+        //a thread count of 0 means use every hardware thread; tiles have to be at least 1 pixel
+        render_scheduler(int w, int h, int tsize, int nthreads) : width(w), height(h), tile_size(tsize)
+        {
+            assert(tile_size >= 1); //a tile size of 0 would never get past the first row
+            if (nthreads <= 0)
+            {
+                nthreads = std::thread::hardware_concurrency();
+            }
+            num_threads = nthreads > 0 ? nthreads : 1;
+        }
+
+        render_scheduler(const render_scheduler&) = delete;
+        render_scheduler& operator=(const render_scheduler&) = delete;
+
+        ~render_scheduler()
+        {
+            {
+                std::lock_guard<std::mutex> guard(pool_lock);
+                stopping = true;
+            }
+            job_ready.notify_all();
+            for (size_t i = 0; i < pool.size(); i++)
+            {
+                pool[i].join();
+            }
+        }
+
+        /* renders the whole image, calling render_tile(tile, thread_id) once per tile
+         * render_tile is called concurrently from different threads, so it should
+         * only write to the pixels inside the tile it was given
+         */
+        template <typename F>
+        void run(F render_tile)
+        {
+            STATS_TIMER(timer_render);
+            std::vector<tile_queue> queues(num_threads);
+
+            //deal tiles out round-robin so every thread starts with a spread of
+            //cheap and expensive regions; stealing evens out whatever is left
+            int k = 0;
+            for (int y = 0; y < height; y += tile_size)
+            {
+                for (int x = 0; x < width; x += tile_size)
+                {
+                    tile t = { x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) };
+                    queues[k++ % num_threads].push(t);
+                }
+            }
+
+            run_on_pool([&](int id)
+            {
+                tile t;
+                while (true)
+                {
+                    if (!queues[id].pop(t) && !steal_tile(queues, id, t))
+                    {
+                        STATS_FLUSH();
+                        return; //no tiles are ever added during a run, so we're done
+                    }
+                    render_tile(t, id);
+                }
+            });
+        }
+
+        int width, height;
+        int tile_size;
+        int num_threads;
+
+    private:
+        //tries every other thread's queue in turn, starting with the next one over
+        bool steal_tile(std::vector<tile_queue>& queues, int thief, tile& t) const
+        {
+            for (int i = 1; i < num_threads; i++)
+            {
+                if (queues[(thief + i) % num_threads].steal(t))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //calls job(id) once on every thread, the calling thread being id 0, and waits for all of them
+        void run_on_pool(const std::function<void(int)>& job)
+        {
+            if (pool.empty())
+            {
+                for (int id = 1; id < num_threads; id++)
+                {
+                    pool.push_back(std::thread([this, id]() { pool_thread(id); }));
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(pool_lock);
+                current_job = &job;
+                generation++;
+                running = num_threads - 1;
+            }
+            job_ready.notify_all();
+            job(0); //the calling thread does its share too
+
+            std::unique_lock<std::mutex> guard(pool_lock);
+            job_done.wait(guard, [this]() { return running == 0; });
+            current_job = 0;
+        }
+
+        void pool_thread(int id)
+        {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> guard(pool_lock);
+            while (true)
+            {
+                job_ready.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+                const std::function<void(int)> *job = current_job;
+                guard.unlock();
+                (*job)(id);
+                guard.lock();
+                if (--running == 0)
+                {
+                    job_done.notify_one();
+                }
+            }
+        }
+
+        std::vector<std::thread> pool; //threads 1 to num_threads - 1
+        std::mutex pool_lock;
+        std::condition_variable job_ready, job_done;
+        const std::function<void(int)> *current_job = 0;
+        uint64_t generation = 0;
+        int running = 0;
+        bool stopping = false;
+};
+
+#endif
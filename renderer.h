@@ -0,0 +1,341 @@
+/* renderer.h
+ * Defines the per-pixel path tracer: following a path through the scene (shade, color)
+ * and rendering a tile of pixels with it, one camera ray at a time or in packets
+ * the single-ray functions take the world as a template parameter: a scene, traced through
+ * hitable and material virtual calls, or a closed_world (closed_world.h), traced without them;
+ * all they need of it are the world_ functions below (world_hit(), world_scatter() and the rest)
+ * light comes from the sky and from emissive materials; with light sampling on, every diffuse bounce
+ * also aims a shadow ray at a light, and the two ways of finding a light are weighed against each other
+ * with multiple importance sampling (Veach, "Robust Monte Carlo Methods for Light Transport Simulation", 1997)
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef RENDERERH
+#define RENDERERH
+
+#include <stdint.h>
+#include "float.h"
+#include "hitable.h"
+#include "scene.h"
+#include "bvh.h"
+#include "ray_packet.h"
+#include "camera.h"
+#include "material.h"
+#include "lights.h"
+#include "framebuffer.h"
+#include "render_scheduler.h"
+#include "rng.h"
+#include "adaptive_sampling.h"
+#include "stats.h"
+
+//settings for following a path through the scene
+struct path_settings
+{
+    int max_depth = 50;            //paths are cut off after this many bounces
+    int rr_depth = 6;              //russian roulette starts after this many bounces; 0 turns it off
+    float rr_min_survival = 0.05f; //lowest chance a path is allowed to survive roulette
+    bool light_sampling = true;    //aim a shadow ray at a light from every diffuse bounce (next-event estimation)
+};
+
+//returns the sky color seen along r; a vertical gradient between white and blue
+inline vec3 sky(const ray& r)
+{
+    vec3 unit_direction = vec3::unit_vector(r.direction());
+    float t = 0.5*(unit_direction.y() + 1.0); //how far along y
+    return vec3::scale( vec3(1.0, 1.0, 1.0), (1.0-t) ) + vec3::scale( vec3(0.5, 0.7, 1.0), t);
+    //linear interpolation (gradient) between white and blue
+}
+
+//the scene's side of the path tracer: its world and its material table, through virtual calls
+inline bool world_hit(const scene& sc, const ray& r, float t_min, float t_max, hit_record& rec)
+{
+    return sc.world->hit(r, t_min, t_max, rec);
+}
+
+inline bool world_scatter(const scene& sc, const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered,
+                          rng& gen)
+{
+    return sc.get_material(rec.mat_id)->scatter(r_in, rec, attenuation, scattered, gen);
+}
+
+inline bool world_occluded(const scene& sc, const ray& r, float t_min, float t_max)
+{
+    return sc.world->occluded(r, t_min, t_max);
+}
+
+//whether what rec hit gives off light; a table lookup, so paths in scenes without lights don't pay a virtual call
+inline bool world_emits(const scene& sc, const hit_record& rec)
+{
+    return sc.material_types[rec.mat_id] == material_light;
+}
+
+inline vec3 world_emitted(const scene& sc, const ray& r_in, const hit_record& rec)
+{
+    return sc.get_material(rec.mat_id)->emitted(r_in, rec);
+}
+
+inline vec3 world_eval(const scene& sc, const ray& r_in, const hit_record& rec, const vec3& direction, float& pdf)
+{
+    return sc.get_material(rec.mat_id)->eval(r_in, rec, direction, pdf);
+}
+
+inline bool world_specular(const scene& sc, const hit_record& rec)
+{
+    return sc.get_material(rec.mat_id)->specular();
+}
+
+inline const light_set& world_lights(const scene& sc)
+{
+    return sc.lights;
+}
+
+inline vec3 world_sky(const scene& sc, const ray& r)
+{
+    return sc.sky_color * sky(r);
+}
+
+//weight for a sample taken with density a, when b is the density another strategy would have taken it with
+inline float power_heuristic(float a, float b)
+{
+    return a * a / (a * a + b * b);
+}
+
+/* next-event estimation: the light reaching rec straight from a point picked on one of lights,
+ * scattered back along r_in, if nothing is in the way
+ * weighted against the chance that scattering would have found the same point (see shade())
+ */
+template <typename W>
+vec3 direct_light(const W& world, const light_set& lights, const ray& r_in, const hit_record& rec, rng& gen)
+{
+    light_sample ls;
+    if (!lights.sample(rec.p, gen, ls))
+    {
+        return vec3(0, 0, 0);
+    }
+    float scatter_pdf;
+    vec3 f = world_eval(world, r_in, rec, ls.direction, scatter_pdf);
+    if (fmaxf(f.r(), fmaxf(f.g(), f.b())) <= 0)
+    {
+        return vec3(0, 0, 0); //facing away, or lit from behind; not worth a shadow ray
+    }
+
+    STATS_COUNT(stat_shadow_rays);
+    //stops just short of the light so it doesn't shadow itself
+    if (world_occluded(world, ray(rec.p, ls.direction), 0.001, ls.distance * (1 - 1e-3f)))
+    {
+        return vec3(0, 0, 0);
+    }
+    return f * vec3::scale(ls.radiance, power_heuristic(ls.pdf, scatter_pdf) / ls.pdf);
+}
+
+/* returns the color for ray r, given whether and where it hit the world
+ * follows the path bounce by bounce in a loop, carrying the product of the attenuations
+ * so far (the throughput) instead of recursing
+ * once a path is rr_depth bounces long, russian roulette ends it with a chance based on
+ * its throughput and scales up the survivors, so dim paths stop early without biasing the result
+ * with light sampling, each diffuse bounce adds the light it gets straight from a light (direct_light()),
+ * and a path that then goes on to hit that light only adds the share of it multiple importance sampling
+ * gives to scattering; hitting the sky, or a light off the camera or a mirror, counts in full
+ * split out of color() so the packet path can shade camera rays it already intersected
+ */
+template <typename W>
+vec3 shade(ray r, bool hit, hit_record rec, const W& world, const path_settings& ps, rng& gen)
+{
+    vec3 throughput(1, 1, 1);
+    vec3 radiance(0, 0, 0); //light picked up on the way, from lights hit or aimed at
+    const light_set *lights = ps.light_sampling && !world_lights(world).empty() ? &world_lights(world) : 0;
+    float scatter_pdf = 0; //density the last bounce picked r with, if it also aimed at a light; otherwise 0
+    STATS_COUNT(stat_paths);
+
+    for (int depth = 0; ; depth++)
+    {
+        if (!hit)
+        {
+            STATS_END_PATH(depth, stat_escaped);
+            return radiance + throughput * world_sky(world, r);
+        }
+
+        if (world_emits(world, rec))
+        {
+            vec3 emitted = world_emitted(world, r, rec);
+            if (scatter_pdf > 0)
+            {
+                emitted = vec3::scale(emitted, power_heuristic(scatter_pdf, lights->pdf(r, rec)));
+            }
+            STATS_END_PATH(depth, stat_lit);
+            return radiance + throughput * emitted;
+        }
+
+        ray scattered;
+        vec3 attenuation;
+
+        gen.start_bounce(depth + 1);
+        if (depth >= ps.max_depth)
+        {
+            STATS_END_PATH(depth, stat_depth_capped);
+            return radiance;
+        }
+        if (!world_scatter(world, r, rec, attenuation, scattered, gen))
+        {
+            STATS_END_PATH(depth, stat_absorbed);
+            return radiance;
+        }
+        vec3 arriving = throughput; //what light reaching this bounce gets scaled by
+        throughput *= attenuation;
+
+        bool survived = true;
+        if (ps.rr_depth > 0 && depth + 1 >= ps.rr_depth)
+        {
+            float survival = fmaxf(throughput.r(), fmaxf(throughput.g(), throughput.b()));
+            survival = fminf(1.0f, fmaxf(survival, ps.rr_min_survival));
+            survived = gen.next() < survival;
+            throughput /= survival;
+        }
+
+        //after the scatter and roulette numbers, so those stay where the sampler puts them
+        scatter_pdf = 0;
+        if (lights && !world_specular(world, rec))
+        {
+            radiance += arriving * direct_light(world, *lights, r, rec, gen);
+            if (survived)
+            {
+                world_eval(world, r, rec, vec3::unit_vector(scattered.direction()), scatter_pdf);
+            }
+        }
+        if (!survived)
+        {
+            STATS_END_PATH(depth + 1, stat_roulette);
+            return radiance;
+        }
+
+        //min t is 0.001 to get rid of shadow acne (hits at t's very close to 0)
+        r = scattered;
+        hit = world_hit(world, r, 0.001, MAXFLOAT, rec);
+        STATS_COUNT(stat_rays);
+    }
+}
+
+/* returns the color at the point intersected in the given world by the given ray
+ * gen is the generator for the current pixel sample, restarted at each bounce
+ */
+template <typename W>
+vec3 color(const ray& r, const W& world, const path_settings& ps, rng& gen)
+{
+    hit_record rec;
+    bool hit = world_hit(world, r, 0.001, MAXFLOAT, rec);
+    STATS_COUNT(stat_rays);
+    return shade(r, hit, rec, world, ps, gen);
+}
+
+struct render_settings
+{
+    int width;
+    int height;
+    adaptive_settings sampling; //max_samples is the fixed sample count when adaptive sampling is off
+    path_settings path;
+    const sampler *source = nullptr; //where each bounce's first numbers come from; nullptr = rng's own
+};
+
+//returns the color of sample s of pixel (i, j), tracing its camera ray through the world
+template <typename W>
+inline vec3 sample_pixel(int i, int j, int s, const W& world, const camera& cam, const render_settings& rs)
+{
+    rng gen(j * rs.width + i, s, rs.source);
+    float u = float(i + gen.next()) / float(rs.width);
+    float v = float(j + gen.next()) / float(rs.height);
+    ray r = cam.get_ray(u, v, gen);
+    return color(r, world, rs.path, gen);
+}
+
+/* renders one tile, tracing each sample's camera ray on its own
+ * returns the number of samples taken, which is less than the maximum under adaptive sampling
+ */
+template <typename W>
+uint64_t render_tile(const tile& t, const W& world, const camera& cam, const render_settings& rs, framebuffer& fb)
+{
+    uint64_t spent = 0;
+    for (int j = t.y0; j < t.y1; j++)
+    {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+            //average colors from samples across pixel
+            pixel_estimate est;
+            for (int s = 0; !est.done(rs.sampling); s++)
+            {
+                est.add(sample_pixel(i, j, s, world, cam, rs));
+            }
+            fb.set(i, j, est);
+            spent += est.n;
+        }
+    }
+    return spent;
+}
+
+/* renders one tile, tracing the camera rays of each W x H block of pixels as one packet
+ * scattered rays go off in all directions, so everything after the first hit is traced
+ * one ray at a time; each lane uses the same generator and accumulation order as
+ * render_tile(), so the image comes out identical
+ * under adaptive sampling, lanes whose pixel has converged drop out of the packet
+ * the scene must have a BVH
+ */
+template <int W, int H>
+uint64_t render_tile_packets(const tile& t, const scene& sc, const camera& cam, const render_settings& rs, framebuffer& fb)
+{
+    const int N = W * H;
+    uint64_t spent = 0;
+    for (int by = t.y0; by < t.y1; by += H)
+    {
+        for (int bx = t.x0; bx < t.x1; bx += W)
+        {
+            pixel_estimate est[N];
+
+            for (int s = 0; ; s++)
+            {
+                ray_packet<N> packet;
+                rng gens[N];
+                for (int l = 0; l < N; l++)
+                {
+                    int i = bx + l % W;
+                    int j = by + l / W;
+                    //blocks hanging off the tile edge leave lanes empty
+                    if (i < t.x1 && j < t.y1 && !est[l].done(rs.sampling))
+                    {
+                        gens[l] = rng(j * rs.width + i, s, rs.source);
+                        float u = float(i + gens[l].next()) / float(rs.width);
+                        float v = float(j + gens[l].next()) / float(rs.height);
+                        packet.set(l, cam.get_ray(u, v, gens[l]));
+                    }
+                }
+                if (packet.active == 0)
+                {
+                    break;
+                }
+
+                hit_record recs[N];
+                uint32_t hits = sc.hit_packet(packet, 0.001, MAXFLOAT, recs);
+                STATS_ADD(stat_rays, __builtin_popcount(packet.active));
+                for (uint32_t lanes = packet.active; lanes; lanes &= lanes - 1)
+                {
+                    int l = __builtin_ctz(lanes);
+                    est[l].add(shade(packet.get(l), (hits >> l) & 1, recs[l], sc, rs.path, gens[l]));
+                }
+            }
+
+            for (int l = 0; l < N; l++)
+            {
+                int i = bx + l % W;
+                int j = by + l / W;
+                if (i < t.x1 && j < t.y1)
+                {
+                    fb.set(i, j, est[l]);
+                    spent += est[l].n;
+                }
+            }
+        }
+    }
+    return spent;
+}
+
+#endif
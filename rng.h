@@ -0,0 +1,95 @@
+/* rng.h
+ * Defines the rng class, a small PCG32 random number generator
+ * that replaces the global drand48() state
+ * a generator is seeded from (pixel, sample) and reseeded at every bounce, so the numbers
+ * a sample sees don't depend on which thread rendered it or in what order;
+ * the same settings always give a bit-identical image
+ * given a sampler (see sampler.h), the first few numbers of each bounce come from it instead
+ * PCG is from O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good
+ * Algorithms for Random Number Generation" (pcg-random.org)
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef RNGH
+#define RNGH
+
+#include <stdint.h>
+#include "sampler.h"
+
+class rng
+{
+    public:
+        rng() { seed(0); }
+        rng(uint64_t s) { seed(s); }
+        rng(uint32_t pixel, uint32_t sample, const sampler *s = nullptr) : pixel_id(pixel), sample_id(sample), source(s)
+        {
+            start_bounce(0);
+        }
+
+        //restarts the stream for the given bounce of the current pixel sample
+        inline void start_bounce(uint32_t bounce)
+        {
+            seed( mix( (uint64_t(pixel_id) << 32 | sample_id) ^ mix(bounce + 1) ) );
+            current_bounce = bounce;
+            dim = 0;
+        }
+
+        //uniform float in [0, 1)
+        inline float next()
+        {
+            if (source && dim < sampler::dims_per_bounce)
+            {
+                if (dim == 0)
+                {
+                    source->get(pixel_id, sample_id, current_bounce, numbers);
+                }
+                return numbers[dim++];
+            }
+            return (next_uint() >> 8) * (1.0f / 16777216.0f); //top 24 bits, exact in a float
+        }
+
+        /* whether next() is drawing from a sampler, whose numbers are only well spread if every one is used;
+         * rejection sampling would throw some away, so callers map them directly instead
+         */
+        inline bool low_discrepancy() const { return source != nullptr; }
+
+        inline uint32_t next_uint()
+        {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = uint32_t( ((old >> 18u) ^ old) >> 27u );
+            uint32_t rot = uint32_t(old >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+        uint64_t state;
+        uint64_t inc;
+        uint32_t pixel_id = 0;
+        uint32_t sample_id = 0;
+        const sampler *source = nullptr; //nullptr = every number from the PCG stream
+        uint32_t current_bounce = 0;
+        uint32_t dim = 0;                //how many numbers this bounce has taken from source
+        float numbers[sampler::dims_per_bounce];
+
+    private:
+        inline void seed(uint64_t s)
+        {
+            state = 0;
+            inc = (mix(s ^ 0x9e3779b97f4a7c15ULL) << 1u) | 1u; //stream must be odd
+            next_uint();
+            state += s;
+            next_uint();
+        }
+
+        //splitmix64 finalizer, used to spread nearby seeds apart
+        static inline uint64_t mix(uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+};
+
+#endif
@@ -0,0 +1,299 @@
+/* sampler.h
+ * Defines the sampler classes, which can stand in for rng's own random numbers
+ * each bounce of a pixel sample (bounce 0 being the camera ray) gets its first dims_per_bounce numbers
+ * from the sampler, made all at once the first time the bounce asks for one,
+ * spread out over the pixel's samples better than independent random numbers are:
+ *   stratified  each pair of numbers is jittered in its own cell of a grid over the pixel's samples
+ *   sobol       4D Sobol points, Owen-scrambled per pixel and bounce
+ *   bluenoise   the same Sobol points in every pixel, offset by a blue noise mask, so the error that's
+ *               left is spread out as fine grain across the image rather than as blotches
+ * each bounce's numbers are decorrelated from every other bounce's, and anything a bounce draws past
+ * dims_per_bounce comes from the rng as before
+ * like rng, a sampler only looks at (pixel, sample, bounce, dimension), so images stay deterministic
+ * the independent sampler is no sampler at all: rng's PCG streams, exactly as without this file
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef SAMPLERH
+#define SAMPLERH
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include "blue_noise.h"
+
+enum sampler_type { sampler_independent, sampler_stratified, sampler_sobol, sampler_blue_noise, sampler_type_count };
+
+const char *sampler_names[sampler_type_count] = { "independent", "stratified", "sobol", "bluenoise" };
+
+//largest float below 1, so samples built from a cell plus a jitter stay in [0, 1)
+const float one_minus_epsilon = 0x1.fffffep-1f;
+
+class sampler
+{
+    public:
+        static const uint32_t dims_per_bounce = 4; //camera: pixel x, y, lens x, y; bounces: scatter + roulette
+
+        virtual ~sampler() {}
+
+        //fills out with the numbers in [0, 1) for the given bounce of sample `sample` of a pixel
+        virtual void get(uint32_t pixel, uint32_t sample, uint32_t bounce, float out[dims_per_bounce]) const = 0;
+
+    protected:
+        //hashes a few indices to 32 well-mixed bits (splitmix64's finalizer, as in rng)
+        static inline uint32_t hash(uint32_t a, uint32_t b, uint32_t c = 0)
+        {
+            uint64_t z = (uint64_t(a) << 32 | b) ^ (uint64_t(c) * 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return uint32_t((z ^ (z >> 31)) >> 32);
+        }
+
+        static inline float to_float(uint32_t bits)
+        {
+            return (bits >> 8) * (1.0f / 16777216.0f); //top 24 bits, exact in a float
+        }
+};
+
+/* jittered stratification: pairs of numbers (dims 0-1 and 2-3) get one cell each of a grid sized to
+ * the sample count, with the cells handed out to samples in a shuffled order per pixel, bounce and pair
+ * samples past the count start a new, differently shuffled, round of the grid
+ */
+class stratified_sampler : public sampler
+{
+    public:
+        stratified_sampler(int samples_per_pixel)
+        {
+            nx = int(ceilf(sqrtf(float(samples_per_pixel > 0 ? samples_per_pixel : 1))));
+            ny = (samples_per_pixel + nx - 1) / nx;
+            if (ny < 1)
+            {
+                ny = 1;
+            }
+            cells = uint32_t(nx * ny);
+        }
+
+        virtual void get(uint32_t pixel, uint32_t sample, uint32_t bounce, float out[dims_per_bounce]) const
+        {
+            for (uint32_t pair = 0; pair < dims_per_bounce / 2; pair++)
+            {
+                uint32_t seed = hash(pixel, bounce * 2 + pair, sample / cells);
+                uint32_t cell = permute(sample % cells, cells, seed);
+                uint32_t jitter = hash(seed, sample);
+                out[2 * pair] = fminf((cell % nx + to_float(jitter)) / nx, one_minus_epsilon);
+                out[2 * pair + 1] = fminf((cell / nx + to_float(jitter << 16)) / ny, one_minus_epsilon);
+            }
+        }
+
+        int nx, ny;
+        uint32_t cells;
+
+    private:
+        /* element i of a pseudorandom permutation of [0, n) picked by seed p
+         * from Kensler, "Correlated Multi-Jittered Sampling" (Pixar technical memo 13-01, 2013)
+         */
+        static uint32_t permute(uint32_t i, uint32_t n, uint32_t p)
+        {
+            uint32_t w = n - 1;
+            w |= w >> 1;
+            w |= w >> 2;
+            w |= w >> 4;
+            w |= w >> 8;
+            w |= w >> 16;
+            do
+            {
+                i ^= p;
+                i *= 0xe170893d;
+                i ^= p >> 16;
+                i ^= (i & w) >> 4;
+                i ^= p >> 8;
+                i *= 0x0929eb3f;
+                i ^= p >> 23;
+                i ^= (i & w) >> 1;
+                i *= 1 | p >> 27;
+                i *= 0x6935fa69;
+                i ^= (i & w) >> 11;
+                i *= 0x74dcb303;
+                i ^= (i & w) >> 2;
+                i *= 0x9e501cc3;
+                i ^= (i & w) >> 2;
+                i *= 0xc860a3df;
+                i &= w;
+                i ^= i >> 5;
+            } while (i >= n);
+            return (i + p) % n;
+        }
+};
+
+/* generator matrices for the first four Sobol dimensions, one column per bit of the sample index,
+ * from Joe and Kuo's direction numbers (new-joe-kuo-6.21201)
+ */
+const uint32_t sobol_matrices[sampler::dims_per_bounce][32] =
+{
+    {
+        0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+        0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+        0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+        0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001,
+    },
+    {
+        0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+        0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+        0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+        0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff,
+    },
+    {
+        0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+        0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+        0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+        0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555,
+    },
+    {
+        0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+        0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+        0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+        0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093,
+    },
+};
+
+//the bits of each dimension of Sobol point `index`
+inline void sobol_point(uint32_t index, uint32_t bits[sampler::dims_per_bounce])
+{
+    bits[0] = bits[1] = bits[2] = bits[3] = 0;
+    for (; index; index &= index - 1)
+    {
+        int column = __builtin_ctz(index); //one column per set bit
+        for (uint32_t d = 0; d < sampler::dims_per_bounce; d++)
+        {
+            bits[d] ^= sobol_matrices[d][column];
+        }
+    }
+}
+
+inline uint32_t reverse_bits(uint32_t v)
+{
+    v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+    v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+    v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+    v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+/* a nested uniform (Owen) scramble of v: each bit is flipped or not depending on the bits above it
+ * hash-based version from Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020)
+ */
+inline uint32_t owen_scramble(uint32_t v, uint32_t seed)
+{
+    v = reverse_bits(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverse_bits(v);
+}
+
+/* Sobol point `sample`, randomized by seed
+ * the index is shuffled first, with an Owen scramble of its own bits (each flipped depending on the bits
+ * above it), which keeps every aligned power-of-two run of indices together, so a prefix is still as well
+ * spread; xoring the index with a constant would do that too, but Sobol points are linear in the index,
+ * so two seeds' points would then be tied together and mixing them (as bounces do) wouldn't converge
+ * then each dimension gets its own Owen scramble
+ * (only the low 16 bits of the index are shuffled: pixels never get near 65536 samples,
+ * and every set bit costs a step in sobol_point)
+ */
+inline void scrambled_sobol_point(uint32_t sample, uint32_t seed, uint32_t bits[sampler::dims_per_bounce])
+{
+    sobol_point((owen_scramble(sample, seed) & 0xffff) | (sample & 0xffff0000), bits);
+    for (uint32_t d = 0; d < sampler::dims_per_bounce; d++)
+    {
+        seed = seed * 747796405u + 2891336453u; //an LCG step, for a different scramble per dimension
+        bits[d] = owen_scramble(bits[d], seed);
+    }
+}
+
+/* scrambled Sobol, with a seed of its own for every pixel and bounce
+ * renders with different seeds have independent errors, e.g. a test image and the reference it's compared to
+ */
+class sobol_sampler : public sampler
+{
+    public:
+        sobol_sampler(uint32_t s = 0) : seed(s) {}
+
+        virtual void get(uint32_t pixel, uint32_t sample, uint32_t bounce, float out[dims_per_bounce]) const
+        {
+            uint32_t bits[dims_per_bounce];
+            scrambled_sobol_point(sample, hash(pixel, bounce, seed), bits);
+            for (uint32_t d = 0; d < dims_per_bounce; d++)
+            {
+                out[d] = to_float(bits[d]);
+            }
+        }
+
+        uint32_t seed;
+};
+
+/* blue-noise-dithered Sobol: every pixel uses the same scrambled points (seeded by the bounce alone),
+ * shifted (mod 1) by the blue noise mask, which each bounce and dimension reads at its own offset
+ * neighbouring pixels then have errors that cancel out when the eye (or a denoiser) blurs them
+ * the scramble matters even with the shift: unscrambled Sobol points are linear in the index, so two
+ * bounces' numbers would be a fixed function of each other and the estimate wouldn't converge
+ */
+class blue_noise_sampler : public sampler
+{
+    public:
+        blue_noise_sampler(int w) : width(w > 0 ? uint32_t(w) : 1) {}
+
+        virtual void get(uint32_t pixel, uint32_t sample, uint32_t bounce, float out[dims_per_bounce]) const
+        {
+            uint32_t bits[dims_per_bounce];
+            scrambled_sobol_point(sample, hash(bounce, 0, 3), bits);
+            uint32_t x = pixel % width, y = pixel / width;
+            for (uint32_t d = 0; d < dims_per_bounce; d++)
+            {
+                //mask offsets along a 2D Weyl sequence, which keeps them far apart from one dimension to the next
+                uint32_t k = bounce * dims_per_bounce + d + 1;
+                float v = to_float(bits[d]) + mask.at(x + ((k * 0xc13fa9a9u) >> 26), y + ((k * 0x91e10da5u) >> 26));
+                out[d] = v < 1.0f ? v : v - 1.0f;
+            }
+        }
+
+        uint32_t width;
+
+    private:
+        blue_noise_mask mask;
+};
+
+/* returns a sampler of the given type for an image of this width with this many samples per pixel,
+ * or nullptr for the independent sampler, i.e. rng's own numbers
+ */
+std::unique_ptr<sampler> make_sampler(sampler_type type, int width, int samples_per_pixel)
+{
+    switch (type)
+    {
+        case sampler_stratified:
+            return std::unique_ptr<sampler>(new stratified_sampler(samples_per_pixel));
+        case sampler_sobol:
+            return std::unique_ptr<sampler>(new sobol_sampler());
+        case sampler_blue_noise:
+            return std::unique_ptr<sampler>(new blue_noise_sampler(width));
+        default:
+            return nullptr;
+    }
+}
+
+//the sampler type called name, or sampler_type_count if there isn't one
+sampler_type find_sampler(const char *name)
+{
+    int t = 0;
+    while (t < sampler_type_count && strcmp(name, sampler_names[t]) != 0)
+    {
+        t++;
+    }
+    return sampler_type(t);
+}
+
+#endif
@@ -0,0 +1,272 @@
+/* scene.h
+ * Defines the scene class, which owns everything that gets rendered:
+ * the objects, the materials they refer to by index, the acceleration structure over them,
+ * and the lights among them
+ * objects and materials come out of separate arenas, so each kind sits contiguously in memory,
+ * and the whole scene is torn down in one go instead of leaking a new per object
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef SCENEH
+#define SCENEH
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include "arena.h"
+#include "hitable.h"
+#include "hitable_list.h"
+#include "material.h"
+#include "bvh.h"
+#include "sphere_batch.h"
+#include "lights.h"
+#include "stats.h"
+
+//how to organize a scene's objects for rendering
+struct accel_settings
+{
+    bool use_bvh = true;
+    bool use_batches = false; //group spheres into SIMD sphere_batches first
+    sphere_isa isa = isa_auto;
+    int num_threads = 0;      //for the BVH build; 0 = every hardware thread
+};
+
+class scene
+{
+    public:
+        scene() {}
+
+        scene(const scene&) = delete;
+        scene& operator=(const scene&) = delete;
+
+        //makes a material of type M and returns its id, which goes in hit_record::mat_id
+        template <typename M, typename... Args>
+        uint32_t add_material(Args&&... args)
+        {
+            M *m = material_mem.make<M>(std::forward<Args>(args)...);
+            materials.push_back(m);
+            material_types.push_back(uint8_t(m->type));
+            return uint32_t(materials.size() - 1);
+        }
+
+        //makes an object of type T and adds it to the scene
+        template <typename T, typename... Args>
+        T *add(Args&&... args)
+        {
+            T *obj = object_mem.make<T>(std::forward<Args>(args)...);
+            objects.push_back(obj);
+            return obj;
+        }
+
+        /* builds what the renderer traces against; call after adding everything
+         * (and again after adding more)
+         * objects with no bounds (planes) would make the BVH's root box, and every box on the way to them,
+         * infinite, so they're kept out of it: the world is then a list of them followed by the BVH,
+         * and a ray tests them one by one first, so a hit on the floor cuts the walk down the tree short
+         */
+        void build(const accel_settings& s)
+        {
+            STATS_TIMER(timer_accel_build);
+            accel_mem.reset();
+            top_level.clear();
+            unbounded.clear();
+            tree = 0;
+
+            std::vector<hitable*> bounded;
+            for (size_t k = 0; k < objects.size(); k++)
+            {
+                aabb box;
+                if (objects[k]->bounding_box(box))
+                {
+                    bounded.push_back(objects[k]);
+                }
+                else
+                {
+                    unbounded.push_back(objects[k]);
+                }
+            }
+
+            top_level = unbounded;
+            if (s.use_batches)
+            {
+                batch_spheres(accel_mem, bounded.data(), int(bounded.size()), top_level, 16, s.isa);
+            }
+            else
+            {
+                top_level.insert(top_level.end(), bounded.begin(), bounded.end());
+            }
+
+            list = accel_mem.make<hitable_list>(top_level.data(), int(top_level.size()));
+            world = list;
+            if (s.use_bvh)
+            {
+                size_t n = unbounded.size();
+                tree = accel_mem.make<bvh>(top_level.data() + n, int(top_level.size() - n), s.num_threads);
+                world = tree;
+                if (n > 0)
+                {
+                    world_parts = unbounded;
+                    world_parts.push_back(tree);
+                    world = accel_mem.make<hitable_list>(world_parts.data(), int(world_parts.size()));
+                }
+            }
+
+            lights.build(objects, materials);
+        }
+
+        /* finds the closest hit for every active lane of p, filling recs[lane]; returns the mask of lanes that hit
+         * each lane gets exactly the hit world->hit() would give it: the unbounded objects one lane at a time,
+         * then the BVH for the whole packet; the scene must have a BVH
+         */
+        template <int N>
+        uint32_t hit_packet(const ray_packet<N>& p, float t_min, float t_max, hit_record *recs) const
+        {
+            float closest[N];
+            ray_hit hits[N];
+            uint32_t hit_mask = 0;
+            for (int l = 0; l < N; l++)
+            {
+                closest[l] = t_max;
+            }
+            for (uint32_t lanes = p.active; lanes && !unbounded.empty(); lanes &= lanes - 1)
+            {
+                int l = __builtin_ctz(lanes);
+                ray r = p.get(l);
+                for (size_t k = 0; k < unbounded.size(); k++)
+                {
+                    if (unbounded[k]->intersect(r, t_min, closest[l], hits[l]))
+                    {
+                        hit_mask |= 1u << l;
+                        closest[l] = hits[l].t;
+                    }
+                }
+            }
+
+            hit_mask |= tree->intersect_packet(p, t_min, closest, hits);
+            for (uint32_t lanes = hit_mask; lanes; lanes &= lanes - 1)
+            {
+                int l = __builtin_ctz(lanes);
+                hits[l].object->surface(p.get(l), hits[l], recs[l]);
+            }
+            return hit_mask;
+        }
+
+        /* brings the acceleration structure up to date after objects have moved, as cheaply as it can:
+         * a BVH is refitted in place, and only rebuilt once its nodes have grown more than
+         * max_refit_growth times bigger on average than they were when built
+         * sphere batches hold copies of their spheres, so with those it's always a full build
+         * returns whether it rebuilt
+         */
+        bool refit(const accel_settings& s)
+        {
+            if (s.use_batches)
+            {
+                build(s);
+                return true;
+            }
+            if (!tree)
+            {
+                return false; //a flat list has nothing to update
+            }
+
+            bool worn;
+            {
+                STATS_TIMER(timer_accel_build);
+                tree->refit();
+                worn = tree->tree.refit_growth() > max_refit_growth;
+            }
+            if (worn)
+            {
+                build(s);
+            }
+            return worn;
+        }
+
+        static constexpr float max_refit_growth = 2.0f; //about 10% slower to trace than a fresh tree, in the cover scene
+
+        inline const material *get_material(uint32_t id) const { return materials[id]; }
+
+        /* destroys everything in the scene but keeps the arenas' memory,
+         * so building many scenes in a row doesn't keep going back to malloc
+         */
+        void reset()
+        {
+            clear_tables();
+            accel_mem.reset();
+            object_mem.reset();
+            material_mem.reset();
+        }
+
+        //destroys everything and frees all the memory
+        void release()
+        {
+            clear_tables();
+            accel_mem.release();
+            object_mem.release();
+            material_mem.release();
+        }
+
+        /* trades everything with other, without copying any objects: they stay where they are in the arenas,
+         * which go along with them, so the BVH and lights still point at the right things
+         */
+        void swap(scene& other)
+        {
+            materials.swap(other.materials);
+            material_types.swap(other.material_types);
+            objects.swap(other.objects);
+            std::swap(world, other.world);
+            std::swap(tree, other.tree);
+            std::swap(list, other.list);
+            unbounded.swap(other.unbounded);
+            std::swap(lights, other.lights);
+            std::swap(sky_color, other.sky_color);
+            material_mem.swap(other.material_mem);
+            object_mem.swap(other.object_mem);
+            accel_mem.swap(other.accel_mem);
+            top_level.swap(other.top_level);
+            world_parts.swap(other.world_parts);
+        }
+
+        inline size_t bytes_used() const
+        {
+            return material_mem.bytes_used() + object_mem.bytes_used() + accel_mem.bytes_used();
+        }
+
+        std::vector<const material*> materials; //indexed by material id
+        std::vector<uint8_t> material_types;    //material_type of each id, without chasing the pointer
+        std::vector<hitable*> objects;
+
+        hitable *world = 0; //what rays are traced against: the BVH (after any unbounded objects), or the flat list
+        bvh *tree = 0;      //the BVH over the bounded objects, if built; packet tracing needs it
+        hitable_list *list = 0;
+        std::vector<hitable*> unbounded; //objects with no bounds, which the BVH leaves out
+
+        light_set lights;               //the objects that can be aimed at for light
+        vec3 sky_color = vec3(1, 1, 1); //multiplies the sky gradient; turned down for scenes lit by their own lights
+
+    private:
+        void clear_tables()
+        {
+            materials.clear();
+            material_types.clear();
+            objects.clear();
+            top_level.clear();
+            unbounded.clear();
+            world_parts.clear();
+            world = 0;
+            tree = 0;
+            list = 0;
+            lights.clear();
+            sky_color = vec3(1, 1, 1);
+        }
+
+        arena material_mem;
+        arena object_mem;
+        arena accel_mem;
+        std::vector<hitable*> top_level;   //objects as the acceleration structure sees them, the unbounded ones first
+        std::vector<hitable*> world_parts; //the unbounded objects and then the BVH, when there are any
+};
+
+#endif
@@ -0,0 +1,1069 @@
+/* scene_file.h
+ * Loads scenes from files instead of building them in code
+ * a text scene lists the camera, named materials, spheres, planes and meshes, one per line:
+ *
+ *     # comments run to the end of the line
+ *     camera lookfrom 4.2 2 3 lookat 0 0 -1 vup 0 1 0 vfov 90 aperture 0.1 focus 5.9
+ *     material ground lambertian 0.5 0.5 0.5
+ *     material mirror metal 0.7 0.6 0.5 0.0     (albedo, then fuzz)
+ *     material glass dielectric 1.5             (refractive index)
+ *     material lamp light 4 4 4                 (radiance given off)
+ *     sky 0.02 0.02 0.03                        (multiplies the sky's gradient; 1 1 1 if not given)
+ *     sphere 0 1 0 1 glass                      (center, radius, material)
+ *     plane 0 0 0 0 1 0 ground                  (a point on it, its normal, material)
+ *     mesh bunny.obj 0 0 0 2 mirror             (OBJ file, position, scale, material)
+ *
+ * every camera key is optional; focus defaults to the distance from lookfrom to lookat
+ * a mesh's OBJ path is relative to the scene file; its vertices are scaled, then moved to position
+ * parsing millions of lines takes seconds, so a scene can also be compiled to a binary file:
+ * a checked header, then the materials, the spheres as flat arrays in BVH leaf order,
+ * the flattened BVH itself, and the planes; loading maps the file and traces against it in place
+ * (only scenes made of nothing but spheres and planes compile; ones with meshes are parsed every time,
+ * and so are ones with lights, which have to be sphere objects for light sampling to find them)
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef SCENEFILEH
+#define SCENEFILEH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "camera.h"
+#include "scene.h"
+#include "sphere.h"
+#include "plane.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "dielectric.h"
+#include "diffuse_light.h"
+#include "stats.h"
+#include "hash.h"
+
+//the camera constructor's arguments, minus the aspect ratio, which comes from the image size
+struct camera_params
+{
+    vec3 lookfrom = vec3(4.2, 2, 3);
+    vec3 lookat = vec3(0, 0, -1);
+    vec3 vup = vec3(0, 1, 0);
+    float vfov = 90;
+    float aperture = 0.1;
+    float focus_dist = 0; //0 = the distance from lookfrom to lookat
+
+    camera make_camera(float aspect) const
+    {
+        float focus = focus_dist > 0 ? focus_dist : (lookat - lookfrom).length();
+        return camera(lookfrom, lookat, vup, vfov, aspect, aperture, focus);
+    }
+
+    //lookfrom, lookat, vup, vfov, aperture, focus_dist; unlike the struct itself, has no padding to hash or write out
+    void to_floats(float out[12]) const
+    {
+        const vec3 *vectors[3] = { &lookfrom, &lookat, &vup };
+        for (int v = 0; v < 3; v++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                out[v * 3 + c] = (*vectors[v])[c];
+            }
+        }
+        out[9] = vfov;
+        out[10] = aperture;
+        out[11] = focus_dist;
+    }
+};
+
+//a whole file mapped read-only; unmapped when destroyed
+class mapped_file
+{
+    public:
+        mapped_file(const char *path)
+        {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+            {
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0)
+            {
+                good = true;
+                size = size_t(st.st_size);
+                if (size > 0)
+                {
+                    void *m = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (m == MAP_FAILED)
+                    {
+                        good = false;
+                        size = 0;
+                    }
+                    else
+                    {
+                        data = (const uint8_t*)m;
+                    }
+                }
+            }
+            close(fd);
+        }
+
+        ~mapped_file()
+        {
+            if (data)
+            {
+                munmap((void*)data, size);
+            }
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        inline bool ok() const { return good; }
+
+        const uint8_t *data = 0;
+        size_t size = 0;
+
+    private:
+        bool good = false;
+};
+
+//----------------------text scenes
+
+//walks a text scene a token at a time, keeping track of the line for error messages
+struct scene_text_parser
+{
+    const char *cur;
+    const char *end;
+    int line = 1;
+
+    //skips blanks and comments; true if the line has nothing more on it
+    bool at_line_end()
+    {
+        while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r'))
+        {
+            cur++;
+        }
+        if (cur < end && *cur == '#')
+        {
+            while (cur < end && *cur != '\n')
+            {
+                cur++;
+            }
+        }
+        return cur == end || *cur == '\n';
+    }
+
+    void next_line()
+    {
+        while (cur < end && *cur != '\n')
+        {
+            cur++;
+        }
+        if (cur < end)
+        {
+            cur++;
+            line++;
+        }
+    }
+
+    bool word(std::string& w)
+    {
+        if (at_line_end())
+        {
+            return false;
+        }
+        const char *start = cur;
+        while (cur < end && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '\n' && *cur != '#')
+        {
+            cur++;
+        }
+        w.assign(start, cur - start);
+        return true;
+    }
+
+    bool number(float& f)
+    {
+        //copied out first: the file is mapped, so there's no terminating 0 for strtof to stop at
+        char text[64];
+        if (at_line_end())
+        {
+            return false;
+        }
+        size_t n = 0;
+        while (cur < end && n < sizeof(text) - 1 && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '\n' &&
+               *cur != '#')
+        {
+            text[n++] = *cur++;
+        }
+        text[n] = 0;
+        char *stop;
+        f = strtof(text, &stop);
+        return stop == text + n;
+    }
+
+    bool vector(vec3& v)
+    {
+        float x, y, z;
+        if (!number(x) || !number(y) || !number(z))
+        {
+            return false;
+        }
+        v = vec3(x, y, z);
+        return true;
+    }
+};
+
+//----------------------OBJ meshes
+
+/* parses size bytes of a Wavefront OBJ file, appending its vertex positions ("v" lines), scaled by scale
+ * and then moved by offset, to positions, and its faces ("f" lines) to indices
+ * faces with more than three corners become fans of triangles; everything else an OBJ file can hold
+ * (texture coordinates, normals, groups, materials) is skipped
+ * it's one pass over the text that only ever appends to the two arrays, so however big the file is,
+ * nothing gets allocated per vertex or triangle
+ * on failure returns false with the reason in error
+ */
+bool parse_obj(const char *text, size_t size, const vec3& offset, float scale, std::vector<float>& positions,
+               std::vector<uint32_t>& indices, std::string& error)
+{
+    scene_text_parser p = { text, text + size };
+    std::vector<uint32_t> corners; //of the current face; reused, so it only grows to the biggest face
+    std::string keyword;
+
+    //one corner of a face, "v", "v/vt", "v//vn" or "v/vt/vn", of which only v matters
+    //indices count from 1, or back from the latest vertex if negative
+    auto corner = [&](uint32_t& index)
+    {
+        bool negative = *p.cur == '-';
+        if (negative)
+        {
+            p.cur++;
+        }
+        const char *digits = p.cur;
+        uint64_t i = 0;
+        while (p.cur < p.end && *p.cur >= '0' && *p.cur <= '9' && i <= UINT32_MAX)
+        {
+            i = i * 10 + uint64_t(*p.cur++ - '0');
+        }
+        bool good = p.cur > digits && (p.cur == p.end || *p.cur == '/' || *p.cur == ' ' || *p.cur == '\t' ||
+                                       *p.cur == '\r' || *p.cur == '\n' || *p.cur == '#');
+        while (p.cur < p.end && *p.cur != ' ' && *p.cur != '\t' && *p.cur != '\r' && *p.cur != '\n' && *p.cur != '#')
+        {
+            p.cur++;
+        }
+
+        uint64_t vertex_count = positions.size() / 3;
+        good = good && i > 0 && (negative ? i <= vertex_count : i <= UINT32_MAX);
+        index = uint32_t(negative ? vertex_count - i : i - 1);
+        return good;
+    };
+
+    while (p.cur < p.end)
+    {
+        if (p.at_line_end())
+        {
+            p.next_line();
+            continue;
+        }
+
+        p.word(keyword);
+        bool good = true;
+        if (keyword == "v")
+        {
+            //anything after x, y and z (a w coordinate, or a vertex color) is ignored
+            vec3 v;
+            good = p.vector(v);
+            v = vec3::scale(v, scale) + offset;
+            positions.push_back(v.x());
+            positions.push_back(v.y());
+            positions.push_back(v.z());
+        }
+        else if (keyword == "f")
+        {
+            corners.clear();
+            uint32_t index;
+            while (good && !p.at_line_end())
+            {
+                good = corner(index);
+                corners.push_back(index);
+            }
+            good = good && corners.size() >= 3;
+            for (size_t k = 2; good && k < corners.size(); k++)
+            {
+                indices.push_back(corners[0]);
+                indices.push_back(corners[k - 1]);
+                indices.push_back(corners[k]);
+            }
+        }
+
+        if (!good)
+        {
+            error = "line " + std::to_string(p.line) + ": bad '" + keyword + "' line";
+            return false;
+        }
+        p.next_line();
+    }
+
+    //faces can name vertices that come later in the file, so the indices can only be checked at the end
+    uint64_t vertex_count = positions.size() / 3;
+    for (size_t k = 0; k < indices.size(); k++)
+    {
+        if (indices[k] >= vertex_count)
+        {
+            error = "face " + std::to_string(k / 3) + " names vertex " + std::to_string(uint64_t(indices[k]) + 1) +
+                    ", but there are only " + std::to_string(vertex_count);
+            return false;
+        }
+    }
+    if (indices.empty())
+    {
+        error = "no faces";
+        return false;
+    }
+    return true;
+}
+
+//maps the OBJ file at path and parses it with parse_obj; errors say which file they're about
+bool load_obj(const char *path, const vec3& offset, float scale, std::vector<float>& positions,
+              std::vector<uint32_t>& indices, std::string& error)
+{
+    mapped_file file(path);
+    if (!file.ok())
+    {
+        error = std::string("couldn't open ") + path;
+        return false;
+    }
+    if (!parse_obj((const char*)file.data, file.size, offset, scale, positions, indices, error))
+    {
+        error = std::string(path) + ", " + error;
+        return false;
+    }
+    return true;
+}
+
+//----------------------text scenes, continued
+
+/* parses size bytes of text scene into sc and cam
+ * mesh files are looked for in dir, which is empty or ends in a '/', and their BVHs are built
+ * on up to num_threads threads (0 = every hardware thread)
+ * on failure returns false with the reason in error; sc may hold part of the scene
+ */
+bool parse_scene_text(const char *text, size_t size, scene& sc, camera_params& cam, std::string& error,
+                      const std::string& dir = "", int num_threads = 0)
+{
+    scene_text_parser p = { text, text + size };
+    std::unordered_map<std::string, uint32_t> material_ids;
+    std::string keyword, name, type, file;
+
+    while (p.cur < p.end)
+    {
+        if (p.at_line_end())
+        {
+            p.next_line();
+            continue;
+        }
+
+        p.word(keyword);
+        bool good = true;
+        if (keyword == "camera")
+        {
+            std::string key;
+            while (good && p.word(key))
+            {
+                if (key == "lookfrom") good = p.vector(cam.lookfrom);
+                else if (key == "lookat") good = p.vector(cam.lookat);
+                else if (key == "vup") good = p.vector(cam.vup);
+                else if (key == "vfov") good = p.number(cam.vfov);
+                else if (key == "aperture") good = p.number(cam.aperture);
+                else if (key == "focus") good = p.number(cam.focus_dist);
+                else good = false;
+            }
+        }
+        else if (keyword == "material")
+        {
+            good = p.word(name) && p.word(type) && material_ids.find(name) == material_ids.end();
+            vec3 albedo;
+            float f;
+            if (good && type == "lambertian" && p.vector(albedo))
+            {
+                material_ids[name] = sc.add_material<lambertian>(albedo);
+            }
+            else if (good && type == "metal" && p.vector(albedo) && p.number(f))
+            {
+                material_ids[name] = sc.add_material<metal>(albedo, f);
+            }
+            else if (good && type == "dielectric" && p.number(f))
+            {
+                material_ids[name] = sc.add_material<dielectric>(f);
+            }
+            else if (good && type == "light" && p.vector(albedo))
+            {
+                material_ids[name] = sc.add_material<diffuse_light>(albedo);
+            }
+            else
+            {
+                good = false;
+            }
+        }
+        else if (keyword == "sky")
+        {
+            good = p.vector(sc.sky_color);
+        }
+        else if (keyword == "sphere")
+        {
+            vec3 center;
+            float radius;
+            good = p.vector(center) && p.number(radius) && p.word(name);
+            auto m = good ? material_ids.find(name) : material_ids.end();
+            good = m != material_ids.end();
+            if (good)
+            {
+                sc.add<sphere>(center, radius, m->second);
+            }
+        }
+        else if (keyword == "plane")
+        {
+            vec3 point, normal;
+            good = p.vector(point) && p.vector(normal) && p.word(name);
+            auto m = good ? material_ids.find(name) : material_ids.end();
+            good = m != material_ids.end() && normal.squared_length() > 0;
+            if (good)
+            {
+                //one that's already unit length is kept as it is, so a scene written back out reads in the same
+                if (fabsf(normal.squared_length() - 1) > 1e-6f)
+                {
+                    normal = vec3::unit_vector(normal);
+                }
+                sc.add<plane>(point, normal, m->second);
+            }
+        }
+        else if (keyword == "mesh")
+        {
+            vec3 position;
+            float scale;
+            good = p.word(file) && p.vector(position) && p.number(scale) && p.word(name);
+            auto m = good ? material_ids.find(name) : material_ids.end();
+            good = m != material_ids.end() && p.at_line_end();
+            if (good)
+            {
+                std::vector<float> positions;
+                std::vector<uint32_t> indices;
+                std::string path = file[0] == '/' ? file : dir + file;
+                if (!load_obj(path.c_str(), position, scale, positions, indices, error))
+                {
+                    error = "line " + std::to_string(p.line) + ": " + error;
+                    return false;
+                }
+                sc.add<mesh>(std::move(positions), std::move(indices), m->second, num_threads);
+            }
+        }
+        else
+        {
+            good = false;
+        }
+
+        if (!good || !p.at_line_end())
+        {
+            error = "line " + std::to_string(p.line) + ": bad or unknown '" + keyword + "' line";
+            return false;
+        }
+        p.next_line();
+    }
+    return true;
+}
+
+/* writes sc and cam out as a text scene, naming material k "m<k>"
+ * floats get 9 significant digits, so reading the file back gives the exact same values
+ */
+bool write_scene_text(const char *path, const scene& sc, const camera_params& cam, std::string& error)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        error = std::string("couldn't open ") + path;
+        return false;
+    }
+
+    fprintf(f, "camera lookfrom %.9g %.9g %.9g lookat %.9g %.9g %.9g vup %.9g %.9g %.9g vfov %.9g aperture %.9g",
+            cam.lookfrom.x(), cam.lookfrom.y(), cam.lookfrom.z(), cam.lookat.x(), cam.lookat.y(), cam.lookat.z(),
+            cam.vup.x(), cam.vup.y(), cam.vup.z(), cam.vfov, cam.aperture);
+    if (cam.focus_dist > 0)
+    {
+        fprintf(f, " focus %.9g", cam.focus_dist);
+    }
+    fprintf(f, "\n");
+    if (sc.sky_color.x() != 1 || sc.sky_color.y() != 1 || sc.sky_color.z() != 1)
+    {
+        fprintf(f, "sky %.9g %.9g %.9g\n", sc.sky_color.x(), sc.sky_color.y(), sc.sky_color.z());
+    }
+
+    bool good = true;
+    for (size_t k = 0; k < sc.materials.size() && good; k++)
+    {
+        const material *m = sc.materials[k];
+        switch (m->type)
+        {
+            case material_lambertian:
+            {
+                vec3 a = static_cast<const lambertian*>(m)->albedo;
+                fprintf(f, "material m%zu lambertian %.9g %.9g %.9g\n", k, a.x(), a.y(), a.z());
+                break;
+            }
+            case material_metal:
+            {
+                const metal *mt = static_cast<const metal*>(m);
+                fprintf(f, "material m%zu metal %.9g %.9g %.9g %.9g\n", k, mt->albedo.x(), mt->albedo.y(),
+                        mt->albedo.z(), mt->fuzz);
+                break;
+            }
+            case material_dielectric:
+                fprintf(f, "material m%zu dielectric %.9g\n", k, static_cast<const dielectric*>(m)->refract_idx);
+                break;
+            case material_light:
+            {
+                vec3 l = static_cast<const diffuse_light*>(m)->radiance;
+                fprintf(f, "material m%zu light %.9g %.9g %.9g\n", k, l.x(), l.y(), l.z());
+                break;
+            }
+            default:
+                error = "material " + std::to_string(k) + " has no text form";
+                good = false;
+        }
+    }
+
+    for (size_t k = 0; k < sc.objects.size() && good; k++)
+    {
+        const sphere *s = dynamic_cast<const sphere*>(sc.objects[k]);
+        const plane *pl = dynamic_cast<const plane*>(sc.objects[k]);
+        if (s)
+        {
+            fprintf(f, "sphere %.9g %.9g %.9g %.9g m%u\n", s->center.x(), s->center.y(), s->center.z(), s->radius,
+                    s->mat_id);
+        }
+        else if (pl)
+        {
+            fprintf(f, "plane %.9g %.9g %.9g %.9g %.9g %.9g m%u\n", pl->point.x(), pl->point.y(), pl->point.z(),
+                    pl->normal.x(), pl->normal.y(), pl->normal.z(), pl->mat_id);
+        }
+        else
+        {
+            error = "object " + std::to_string(k) + " isn't a sphere or a plane";
+            good = false;
+            break;
+        }
+    }
+
+    if (fclose(f) != 0 && good)
+    {
+        error = std::string("couldn't write ") + path;
+        good = false;
+    }
+    return good;
+}
+
+//----------------------compiled scenes
+
+const uint32_t scene_file_version = 3; //2 added the sky color, 3 the planes
+const size_t scene_file_align = 64; //every section starts on a cache line
+
+struct scene_file_header
+{
+    char magic[8];          //"RTSCENE1"
+    uint32_t version;       //scene_file_version
+    uint32_t header_size;   //sizeof(scene_file_header), so a layout change can't slip through
+    uint64_t file_size;
+    uint64_t source_hash;   //hash_bytes of the text scene this was compiled from
+    float camera[12];       //lookfrom, lookat, vup, vfov, aperture, focus_dist
+    float sky[3];           //scene::sky_color
+    uint32_t material_count;
+    uint32_t sphere_count;
+    uint32_t node_count;
+    uint32_t plane_count;
+    uint64_t materials_offset; //material_record[material_count]
+    uint64_t spheres_offset;   //center x, y, z, radius and material id arrays, in BVH leaf order
+    uint64_t nodes_offset;     //bvh_node[node_count]
+    uint64_t planes_offset;    //plane_record[plane_count]
+    uint64_t header_hash;      //hash_bytes of everything above
+};
+
+struct material_record
+{
+    uint32_t type;    //material_type
+    float albedo[3];
+    float param;      //metal: fuzz, dielectric: refractive index
+};
+
+struct plane_record
+{
+    float point[3];
+    float normal[3];
+    uint32_t mat_id;
+};
+
+//bytes taken by one of the sphere arrays
+inline size_t sphere_array_bytes(uint32_t count)
+{
+    return (size_t(count) * 4 + scene_file_align - 1) & ~(scene_file_align - 1);
+}
+
+inline uint64_t scene_header_hash(const scene_file_header& h)
+{
+    return hash_bytes(&h, offsetof(scene_file_header, header_hash));
+}
+
+/* a compiled scene's spheres and BVH, traced straight out of the mapped file
+ * hits come out exactly as they would from sphere objects under a bvh
+ */
+class mapped_spheres: public hitable
+{
+    public:
+        mapped_spheres(std::unique_ptr<mapped_file> f) : file(std::move(f))
+        {
+            const scene_file_header *h = (const scene_file_header*)file->data;
+            const uint8_t *spheres = file->data + h->spheres_offset;
+            size_t stride = sphere_array_bytes(h->sphere_count);
+            cx = (const float*)spheres;
+            cy = (const float*)(spheres + stride);
+            cz = (const float*)(spheres + 2 * stride);
+            radius = (const float*)(spheres + 3 * stride);
+            mat_id = (const uint32_t*)(spheres + 4 * stride);
+            nodes = (const bvh_node*)(file->data + h->nodes_offset);
+            count = h->sphere_count;
+        }
+
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
+        {
+            if (count == 0)
+            {
+                return false;
+            }
+            return bvh_tree::traverse_nodes(nodes, r, t_min, t_max,
+                [&](uint32_t first, uint32_t n, float& closest_so_far)
+                {
+                    bool hit_anything = false;
+                    for (uint32_t i = first; i < first + n; i++)
+                    {
+                        if (sphere::intersect_sphere(vec3(cx[i], cy[i], cz[i]), radius[i], r, t_min, closest_so_far,
+                                                     closest_so_far))
+                        {
+                            hit_anything = true;
+                            h.prim = i;
+                        }
+                    }
+                    if (hit_anything)
+                    {
+                        h.t = closest_so_far;
+                        h.object = this;
+                    }
+                    return hit_anything;
+                });
+        }
+
+        virtual void surface(const ray& r, const ray_hit& h, hit_record& rec) const
+        {
+            uint32_t i = h.prim;
+            sphere::sphere_surface(vec3(cx[i], cy[i], cz[i]), radius[i], mat_id[i], r, h.t, rec);
+            rec.object = this; //none of these can be lights, so there's no sphere object to name
+        }
+
+        virtual bool occluded(const ray& r, float t_min, float t_max) const
+        {
+            if (count == 0)
+            {
+                return false;
+            }
+            return bvh_tree::traverse_nodes<true>(nodes, r, t_min, t_max,
+                [&](uint32_t first, uint32_t n, float& t)
+                {
+                    float t_hit;
+                    for (uint32_t i = first; i < first + n; i++)
+                    {
+                        if (sphere::intersect_sphere(vec3(cx[i], cy[i], cz[i]), radius[i], r, t_min, t, t_hit))
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+        }
+
+        virtual bool bounding_box(aabb& box) const
+        {
+            if (count == 0)
+            {
+                return false;
+            }
+            box = aabb(vec3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]),
+                       vec3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+            return true;
+        }
+
+        const float *cx, *cy, *cz, *radius;
+        const uint32_t *mat_id;
+        const bvh_node *nodes;
+        uint32_t count;
+
+    private:
+        std::unique_ptr<mapped_file> file;
+};
+
+/* compiles sc and cam into a binary scene at path; every object has to be a sphere or a plane
+ * the file is written under a temporary name and renamed into place, so a reader never sees half of it
+ */
+bool write_scene_binary(const char *path, const scene& sc, const camera_params& cam, uint64_t source_hash,
+                        std::string& error, int num_threads = 0)
+{
+    std::vector<const sphere*> spheres;
+    std::vector<aabb> boxes;
+    std::vector<plane_record> planes;
+    for (size_t k = 0; k < sc.objects.size(); k++)
+    {
+        if (const sphere *s = dynamic_cast<const sphere*>(sc.objects[k]))
+        {
+            spheres.push_back(s);
+            boxes.emplace_back();
+            s->bounding_box(boxes.back());
+        }
+        else if (const plane *pl = dynamic_cast<const plane*>(sc.objects[k]))
+        {
+            plane_record rec;
+            for (int c = 0; c < 3; c++)
+            {
+                rec.point[c] = pl->point[c];
+                rec.normal[c] = pl->normal[c];
+            }
+            rec.mat_id = pl->mat_id;
+            planes.push_back(rec);
+        }
+        else
+        {
+            error = "object " + std::to_string(k) + " isn't a sphere or a plane";
+            return false;
+        }
+    }
+
+    std::vector<material_record> materials(sc.materials.size());
+    for (size_t k = 0; k < sc.materials.size(); k++)
+    {
+        const material *m = sc.materials[k];
+        material_record& rec = materials[k];
+        memset(&rec, 0, sizeof(rec));
+        rec.type = m->type;
+        vec3 albedo(0, 0, 0);
+        switch (m->type)
+        {
+            case material_lambertian: albedo = static_cast<const lambertian*>(m)->albedo; break;
+            case material_metal:
+                albedo = static_cast<const metal*>(m)->albedo;
+                rec.param = static_cast<const metal*>(m)->fuzz;
+                break;
+            case material_dielectric: rec.param = static_cast<const dielectric*>(m)->refract_idx; break;
+            case material_light:
+                error = "material " + std::to_string(k) + " is a light, which mapped spheres can't be sampled as";
+                return false;
+            default:
+                error = "material " + std::to_string(k) + " can't be compiled";
+                return false;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            rec.albedo[c] = albedo[c];
+        }
+    }
+
+    bvh_tree tree;
+    tree.build(boxes, num_threads);
+
+    scene_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "RTSCENE1", 8);
+    h.version = scene_file_version;
+    h.header_size = sizeof(scene_file_header);
+    h.source_hash = source_hash;
+    cam.to_floats(h.camera);
+    for (int c = 0; c < 3; c++)
+    {
+        h.sky[c] = sc.sky_color[c];
+    }
+    h.material_count = uint32_t(materials.size());
+    h.sphere_count = uint32_t(spheres.size());
+    h.node_count = uint32_t(tree.nodes.size());
+    h.plane_count = uint32_t(planes.size());
+
+    auto align_up = [](size_t n) { return (n + scene_file_align - 1) & ~(scene_file_align - 1); };
+    h.materials_offset = align_up(sizeof(h));
+    h.spheres_offset = align_up(h.materials_offset + materials.size() * sizeof(material_record));
+    h.nodes_offset = h.spheres_offset + 5 * sphere_array_bytes(h.sphere_count);
+    h.planes_offset = align_up(h.nodes_offset + tree.nodes.size() * sizeof(bvh_node));
+    h.file_size = h.planes_offset + planes.size() * sizeof(plane_record);
+    h.header_hash = scene_header_hash(h);
+
+    std::string temp_path = std::string(path) + ".tmp";
+    int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, h.file_size) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(temp_path.c_str());
+        }
+        error = std::string("couldn't create ") + temp_path;
+        return false;
+    }
+    void *m = mmap(0, h.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED)
+    {
+        close(fd);
+        unlink(temp_path.c_str());
+        error = std::string("couldn't map ") + temp_path;
+        return false;
+    }
+
+    uint8_t *data = (uint8_t*)m;
+    memcpy(data, &h, sizeof(h));
+    memcpy(data + h.materials_offset, materials.data(), materials.size() * sizeof(material_record));
+    size_t stride = sphere_array_bytes(h.sphere_count);
+    float *cx = (float*)(data + h.spheres_offset);
+    float *cy = (float*)(data + h.spheres_offset + stride);
+    float *cz = (float*)(data + h.spheres_offset + 2 * stride);
+    float *radius = (float*)(data + h.spheres_offset + 3 * stride);
+    uint32_t *mat_id = (uint32_t*)(data + h.spheres_offset + 4 * stride);
+    for (uint32_t i = 0; i < h.sphere_count; i++)
+    {
+        const sphere *s = spheres[tree.prim_order[i]];
+        cx[i] = s->center.x();
+        cy[i] = s->center.y();
+        cz[i] = s->center.z();
+        radius[i] = s->radius;
+        mat_id[i] = s->mat_id;
+    }
+    memcpy(data + h.nodes_offset, tree.nodes.data(), tree.nodes.size() * sizeof(bvh_node));
+    memcpy(data + h.planes_offset, planes.data(), planes.size() * sizeof(plane_record));
+
+    bool good = munmap(m, h.file_size) == 0;
+    good = close(fd) == 0 && good;
+    good = good && rename(temp_path.c_str(), path) == 0;
+    if (!good)
+    {
+        unlink(temp_path.c_str());
+        error = std::string("couldn't write ") + path;
+    }
+    return good;
+}
+
+//true if path starts like a compiled scene
+bool is_scene_binary(const char *path)
+{
+    char magic[8] = { 0 };
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+    size_t n = fread(magic, 1, 8, f);
+    fclose(f);
+    return n == 8 && memcmp(magic, "RTSCENE1", 8) == 0;
+}
+
+/* maps the compiled scene at path and adds it to sc as one mapped_spheres object and its planes, setting cam
+ * the header, section bounds, material ids, and the tree's links (one parent per node) and depth are all checked
+ * before sc is touched, so a bad file can't send a ray out of bounds; on failure error says why and sc is unchanged
+ * if expected_source_hash isn't 0, a file compiled from some other text is rejected too
+ * if source_hash isn't null, it gets the hash of the text the file was compiled from
+ */
+bool load_scene_binary(const char *path, scene& sc, camera_params& cam, std::string& error,
+                       uint64_t expected_source_hash = 0, uint64_t *source_hash = 0)
+{
+    std::unique_ptr<mapped_file> file(new mapped_file(path));
+    if (!file->ok())
+    {
+        error = std::string("couldn't open ") + path;
+        return false;
+    }
+
+    const scene_file_header *h = (const scene_file_header*)file->data;
+    if (file->size < sizeof(scene_file_header) || memcmp(h->magic, "RTSCENE1", 8) != 0)
+    {
+        error = std::string(path) + " isn't a compiled scene";
+        return false;
+    }
+    if (h->version != scene_file_version || h->header_size != sizeof(scene_file_header))
+    {
+        error = std::string(path) + " was compiled by a different version";
+        return false;
+    }
+    if (h->header_hash != scene_header_hash(*h) || h->file_size != file->size)
+    {
+        error = std::string(path) + " is corrupt";
+        return false;
+    }
+    if (expected_source_hash != 0 && h->source_hash != expected_source_hash)
+    {
+        error = std::string(path) + " was compiled from a different scene";
+        return false;
+    }
+
+    bool sections_fit = h->materials_offset % scene_file_align == 0 && h->spheres_offset % scene_file_align == 0 &&
+                        h->nodes_offset % alignof(bvh_node) == 0 &&
+                        h->materials_offset + uint64_t(h->material_count) * sizeof(material_record) <= file->size &&
+                        h->spheres_offset + 5 * sphere_array_bytes(h->sphere_count) <= file->size &&
+                        h->nodes_offset + uint64_t(h->node_count) * sizeof(bvh_node) <= file->size &&
+                        h->planes_offset % scene_file_align == 0 &&
+                        h->planes_offset + uint64_t(h->plane_count) * sizeof(plane_record) <= file->size &&
+                        (h->node_count == 0) == (h->sphere_count == 0);
+    if (!sections_fit)
+    {
+        error = std::string(path) + " is corrupt";
+        return false;
+    }
+
+    const material_record *materials = (const material_record*)(file->data + h->materials_offset);
+    for (uint32_t k = 0; k < h->material_count; k++)
+    {
+        if (materials[k].type >= material_light)
+        {
+            error = std::string(path) + ": material " + std::to_string(k) + " has an unknown type";
+            return false;
+        }
+    }
+
+    //the material ids and node links are the only values that index anything
+    const uint32_t *mat_ids = (const uint32_t*)(file->data + h->spheres_offset + 4 * sphere_array_bytes(h->sphere_count));
+    for (uint32_t i = 0; i < h->sphere_count; i++)
+    {
+        if (mat_ids[i] >= h->material_count)
+        {
+            error = std::string(path) + ": sphere " + std::to_string(i) + " has a bad material id";
+            return false;
+        }
+    }
+    const plane_record *planes = (const plane_record*)(file->data + h->planes_offset);
+    for (uint32_t i = 0; i < h->plane_count; i++)
+    {
+        if (planes[i].mat_id >= h->material_count)
+        {
+            error = std::string(path) + ": plane " + std::to_string(i) + " has a bad material id";
+            return false;
+        }
+    }
+    //children always come after their parent, so one pass in order sees every node's parent before the node;
+    //every node but the root has to have exactly one, or one node could reach another by two paths of
+    //different lengths and its depth wouldn't mean anything
+    const bvh_node *nodes = (const bvh_node*)(file->data + h->nodes_offset);
+    std::vector<uint8_t> depth(h->node_count, 0);
+    std::vector<bool> has_parent(h->node_count, false);
+    for (uint32_t k = 0; k < h->node_count; k++)
+    {
+        bool linked = (k == 0 || has_parent[k]) &&
+                      (nodes[k].count > 0 ? uint64_t(nodes[k].offset) + nodes[k].count <= h->sphere_count
+                                          : nodes[k].offset > k + 1 && nodes[k].offset < h->node_count);
+        if (linked && nodes[k].count == 0)
+        {
+            linked = depth[k] < bvh_tree::max_depth && !has_parent[k + 1] && !has_parent[nodes[k].offset];
+            depth[k + 1] = depth[nodes[k].offset] = depth[k] + 1;
+            has_parent[k + 1] = has_parent[nodes[k].offset] = true;
+        }
+        if (!linked || nodes[k].axis > 2)
+        {
+            error = std::string(path) + ": bvh node " + std::to_string(k) + " is corrupt";
+            return false;
+        }
+    }
+
+    for (uint32_t k = 0; k < h->material_count; k++)
+    {
+        const material_record& m = materials[k];
+        vec3 albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        switch (m.type)
+        {
+            case material_lambertian: sc.add_material<lambertian>(albedo); break;
+            case material_metal: sc.add_material<metal>(albedo, m.param); break;
+            default: sc.add_material<dielectric>(m.param); break;
+        }
+    }
+
+    cam.lookfrom = vec3(h->camera[0], h->camera[1], h->camera[2]);
+    cam.lookat = vec3(h->camera[3], h->camera[4], h->camera[5]);
+    cam.vup = vec3(h->camera[6], h->camera[7], h->camera[8]);
+    cam.vfov = h->camera[9];
+    cam.aperture = h->camera[10];
+    cam.focus_dist = h->camera[11];
+    sc.sky_color = vec3(h->sky[0], h->sky[1], h->sky[2]);
+
+    //a handful at most, so they're copied out as plane objects rather than traced in place
+    for (uint32_t i = 0; i < h->plane_count; i++)
+    {
+        const plane_record& p = planes[i];
+        sc.add<plane>(vec3(p.point[0], p.point[1], p.point[2]), vec3(p.normal[0], p.normal[1], p.normal[2]), p.mat_id);
+    }
+    if (source_hash)
+    {
+        *source_hash = h->source_hash;
+    }
+    sc.add<mapped_spheres>(std::move(file));
+    return true;
+}
+
+/* loads the scene at path into sc and cam
+ * a compiled scene is mapped as is; a text scene is first looked up in its compiled cache,
+ * path + ".bin", and only parsed if the cache is missing or was compiled from different text,
+ * in which case the cache is rewritten for next time (if the scene can be compiled)
+ * from_cache says whether the parse was skipped, and source_hash gets a hash of the scene's text
+ * (for a compiled scene, of the text it was compiled from), which changes whenever the scene does;
+ * the OBJ files a mesh line names aren't part of it
+ */
+bool load_scene(const char *path, scene& sc, camera_params& cam, std::string& error, bool& from_cache,
+                uint64_t& source_hash, int num_threads = 0)
+{
+    STATS_TIMER(timer_scene_load);
+    from_cache = false;
+    source_hash = 0;
+    if (is_scene_binary(path))
+    {
+        from_cache = true;
+        return load_scene_binary(path, sc, cam, error, 0, &source_hash);
+    }
+
+    mapped_file text(path);
+    if (!text.ok())
+    {
+        error = std::string("couldn't open ") + path;
+        return false;
+    }
+    //0 is reserved for "don't check"
+    source_hash = hash_bytes(text.data, text.size) | 1;
+
+    std::string cache_path = std::string(path) + ".bin";
+    std::string cache_error;
+    if (load_scene_binary(cache_path.c_str(), sc, cam, cache_error, source_hash))
+    {
+        from_cache = true;
+        return true;
+    }
+
+    const char *slash = strrchr(path, '/');
+    std::string dir(path, slash ? slash + 1 - path : 0);
+    if (!parse_scene_text((const char*)text.data, text.size, sc, cam, error, dir, num_threads))
+    {
+        error = std::string(path) + ", " + error;
+        return false;
+    }
+    //a scene that can't be cached (say, in a read-only directory) still renders, just slower to start
+    write_scene_binary(cache_path.c_str(), sc, cam, source_hash, cache_error, num_threads);
+    return true;
+}
+
+#endif
@@ -0,0 +1,94 @@
+/* scenes.h
+ * Scenes built in code, shared by the renderer and the benchmarks
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef SCENESH
+#define SCENESH
+
+#include "scene.h"
+#include "sphere.h"
+#include "plane.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "dielectric.h"
+#include "diffuse_light.h"
+#include "mesh.h"
+#include "rng.h"
+#include "stats.h"
+
+/* builds the cover scene into sc: a floor, three big spheres and a grid of small random ones
+ * the grid covers [-grid, grid) on x and z; the original scene uses 11
+ * the original's floor is a sphere of radius 1000 whose top is at y = 0; this one is the plane y = 0,
+ * which is cheaper to hit and stays out of the BVH
+ */
+void random_scene(scene& sc, rng& gen, int grid = 11)
+{
+    STATS_TIMER(timer_scene_load);
+
+    //the floor
+    sc.add<plane>( vec3(0, 0, 0), vec3(0, 1, 0), sc.add_material<lambertian>(vec3(0.5, 0.5, 0.5)) );
+
+    for (int a = -grid; a < grid; a++)
+    {
+        for (int b = -grid; b < grid; b++)
+        {
+            float choose_mat = gen.next();
+            vec3 center(a + 0.9*gen.next(), 0.2, b + 0.9*gen.next());
+
+            //space away from big spheres, I think?
+            if ((center - vec3(4, 0.2, 0)).length() > 0.9) 
+            {
+                if (choose_mat < 0.8) //diffuse
+                {
+                    sc.add<sphere>(center, 0.2, sc.add_material<lambertian>( vec3(gen.next()*gen.next(),
+                                                                                  gen.next()*gen.next(),
+                                                                                  gen.next()*gen.next()) ));
+                }
+                else if (choose_mat < 0.95) //metal
+                {
+                    sc.add<sphere>( center, 0.2,
+                                    sc.add_material<metal>( vec3(0.5*(1 + gen.next()), 0.5*(1 + gen.next()), 0.5*(1 + gen.next())), 0.5*gen.next() ) );
+                }
+                else //glass
+                {
+                    sc.add<sphere>( center, 0.2, sc.add_material<dielectric>(1.5) );
+                }
+            }
+        }
+    }
+
+    //three big spheres
+    sc.add<sphere>( vec3(0, 1, 0), 1.0, sc.add_material<dielectric>(1.5) );
+    sc.add<sphere>( vec3(-4, 1, 0), 1.0, sc.add_material<lambertian>(vec3(0.4, 0.2, 0.1)) );
+    sc.add<sphere>( vec3(4, 1, 0), 1.0, sc.add_material<metal>(vec3(0.7, 0.6, 0.5), 0.0) );
+}
+
+/* the cover scene at night: the sky turned almost all the way down, and the light coming instead from
+ * a small, bright square panel overhead (a two-triangle mesh) and a few small glowing spheres floating over the grid
+ * most of the light paths find comes from a small part of the sky of each point, which is
+ * what light sampling is for
+ */
+void lit_scene(scene& sc, rng& gen, int grid = 11)
+{
+    random_scene(sc, gen, grid);
+    STATS_TIMER(timer_scene_load);
+    sc.sky_color = vec3(0.02, 0.02, 0.03);
+
+    //the panel faces down: its vertices go counter-clockwise seen from below
+    std::vector<float> corners = { -0.5, 6, -0.5,  0.5, 6, -0.5,  0.5, 6, 0.5,  -0.5, 6, 0.5 };
+    std::vector<uint32_t> triangles = { 0, 1, 2,  0, 2, 3 };
+    sc.add<mesh>(corners, triangles, sc.add_material<diffuse_light>(vec3(64, 60, 56)));
+
+    const int glowing = 5;
+    for (int k = 0; k < glowing; k++)
+    {
+        vec3 center(-8 + 8 * gen.next(), 1.2 + gen.next(), -6 + 6 * gen.next()); //over the far side of the grid from the default camera
+        vec3 color(0.5 + gen.next(), 0.5 + gen.next(), 0.5 + gen.next());
+        sc.add<sphere>(center, 0.15, sc.add_material<diffuse_light>(vec3::scale(color, 10)));
+    }
+}
+
+#endif
@@ -10,7 +10,7 @@
 #define SPHEREH
 
 #include "hitable.h"
-#include "material.h"
+#include "stats.h"
 
 //apparently the "public" before hitable means that the public members of hitable
 //become public members of sphere, and similarly for the protected members
@@ -18,16 +18,47 @@ class sphere: public hitable
 {
     public:
         sphere() {}
-        sphere(vec3 cen, float r, material *m_ptr) : center(cen), radius(r), mat_ptr(m_ptr) {};
-        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        sphere(vec3 cen, float r, uint32_t m) : center(cen), radius(r), mat_id(m) {};
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const;
+        virtual void surface(const ray& r, const ray_hit& h, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+
+        //the intersection itself, for code that keeps spheres as plain arrays instead of sphere objects:
+        //the t of the closest hit in (t_min, t_max), if there is one
+        //(inline, so t stays in a register instead of going through memory on every test)
+        static bool intersect_sphere(const vec3& center, float radius, const ray& r, float t_min, float t_max,
+                                     float& t);
+        //and the surface at t
+        static void sphere_surface(const vec3& center, float radius, uint32_t mat_id, const ray& r, float t,
+                                   hit_record& rec);
 
         vec3 center;
         float radius;
-        material *mat_ptr;
+        uint32_t mat_id;
 };
 
-bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+bool sphere::intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
+{
+    float t;
+    if (!intersect_sphere(center, radius, r, t_min, t_max, t))
+    {
+        return false;
+    }
+    h.t = t;
+    h.object = this;
+    h.prim = 0;
+    return true;
+}
+
+void sphere::surface(const ray& r, const ray_hit& h, hit_record& rec) const
 {
+    sphere_surface(center, radius, mat_id, r, h.t, rec);
+    rec.object = this;
+}
+
+inline bool sphere::intersect_sphere(const vec3& center, float radius, const ray& r, float t_min, float t_max, float& t)
+{
+    STATS_COUNT(stat_sphere_tests);
     //math based on manipulating equations defining sphere and ray, as described in ch 4
     vec3 oc = r.origin() - center;
     float a = vec3::dot(r.direction(), r.direction());
@@ -39,20 +70,16 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
         float temp = (-b - sqrt(discriminant)) / (2.0*a); //note: tutorial changed this as well, taking out the 2, here and below
         if (temp < t_max && temp > t_min) //if t is within desired interval
         {
-            rec.t = temp;
-            rec.p = r.point_at_t(temp);
-            rec.normal = vec3::scale((rec.p - center), (1.0/radius));
-            rec.mat_ptr = mat_ptr;
+            t = temp;
+            STATS_COUNT(stat_sphere_hits);
             return true;
         }
 
         temp = (-b + sqrt(discriminant)) / (2.0*a);
         if (temp < t_max && temp > t_min) //if t is within desired interval
         {
-            rec.t = temp;
-            rec.p = r.point_at_t(temp);
-            rec.normal = vec3::scale((rec.p - center), (1.0/radius));
-            rec.mat_ptr = mat_ptr;
+            t = temp;
+            STATS_COUNT(stat_sphere_hits);
             return true;
         }
     }
@@ -61,4 +88,20 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     return false;
 }
 
+void sphere::sphere_surface(const vec3& center, float radius, uint32_t mat_id, const ray& r, float t,
+                            hit_record& rec)
+{
+    rec.t = t;
+    rec.p = r.point_at_t(t);
+    rec.normal = vec3::scale((rec.p - center), (1.0/radius));
+    rec.mat_id = mat_id;
+}
+
+bool sphere::bounding_box(aabb& box) const
+{
+    float r = fabsf(radius); //bubbles use a negative radius
+    box = aabb(center - vec3(r, r, r), center + vec3(r, r, r));
+    return true;
+}
+
 #endif
\ No newline at end of file
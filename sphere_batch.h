@@ -0,0 +1,370 @@
+/* sphere_batch.h
+ * Defines the sphere_batch class, a hitable holding many spheres in structure-of-arrays form
+ * centers, radii and material ids live in separate arrays, so one ray can be tested
+ * against 8 (AVX2) or 16 (AVX-512) spheres at once instead of one virtual sphere::hit at a time
+ * the instruction set is picked at runtime from what the CPU supports, with a scalar fallback
+ * the math is the same quadratic as sphere::hit, so hits match it to within float rounding
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef SPHEREBATCHH
+#define SPHEREBATCHH
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "hitable.h"
+#include "sphere.h"
+#include "bvh.h"
+#include "arena.h"
+#include "stats.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPHERE_BATCH_X86
+#include <immintrin.h>
+#endif
+
+enum sphere_isa { isa_auto, isa_scalar, isa_avx2, isa_avx512, isa_count };
+
+class sphere_batch: public hitable
+{
+    public:
+        //arrays are padded to a multiple of this so the widest loop never reads past the end
+        static const int lane_pad = 16;
+
+        sphere_batch(sphere_isa requested = isa_auto) : count(0)
+        {
+            isa = requested == isa_auto ? detect_isa() : requested;
+        }
+
+        //source is the sphere it copies, which hits on it are reported as; 0 reports them as the batch
+        void add(const vec3& center, float r, uint32_t m, const hitable *source = 0)
+        {
+            //overwrite the first padding slot, then re-pad
+            cx.resize(count); cy.resize(count); cz.resize(count); radius.resize(count); mat_id.resize(count);
+            cx.push_back(center.x());
+            cy.push_back(center.y());
+            cz.push_back(center.z());
+            radius.push_back(r);
+            mat_id.push_back(m);
+            sources.push_back(source ? source : this);
+            count++;
+
+            //padding spheres have a NaN center, so every comparison on them fails
+            int padded = (count + lane_pad - 1) / lane_pad * lane_pad;
+            cx.resize(padded, NAN); cy.resize(padded, NAN); cz.resize(padded, NAN);
+            radius.resize(padded, 1.0f); mat_id.resize(padded, 0);
+
+            float ar = fabsf(r);
+            box.expand(aabb(center - vec3(ar, ar, ar), center + vec3(ar, ar, ar)));
+        }
+
+        virtual bool intersect(const ray& r, float t_min, float t_max, ray_hit& h) const
+        {
+            STATS_COUNT(stat_batch_tests);
+            int index;
+            float t;
+            switch (isa)
+            {
+#ifdef SPHERE_BATCH_X86
+                case isa_avx512: index = closest_avx512(r, t_min, t_max, t); break;
+                case isa_avx2: index = closest_avx2(r, t_min, t_max, t); break;
+#endif
+                default: index = closest_scalar(r, t_min, t_max, t); break;
+            }
+
+            if (index < 0)
+            {
+                return false;
+            }
+            h.t = t;
+            h.object = this;
+            h.prim = uint32_t(index);
+            return true;
+        }
+
+        virtual void surface(const ray& r, const ray_hit& h, hit_record& rec) const
+        {
+            uint32_t index = h.prim;
+            sphere::sphere_surface(vec3(cx[index], cy[index], cz[index]), radius[index], mat_id[index], r, h.t, rec);
+            rec.object = sources[index];
+        }
+
+        virtual bool bounding_box(aabb& b) const
+        {
+            b = box;
+            return count > 0;
+        }
+
+        static sphere_isa detect_isa()
+        {
+            if (isa_supported(isa_avx512))
+            {
+                return isa_avx512;
+            }
+            if (isa_supported(isa_avx2))
+            {
+                return isa_avx2;
+            }
+            return isa_scalar;
+        }
+
+        //whether this CPU can run i's kernel; forcing one it can't would die on an illegal instruction
+        static bool isa_supported(sphere_isa i)
+        {
+#ifdef SPHERE_BATCH_X86
+            __builtin_cpu_init();
+            switch (i)
+            {
+                case isa_avx512: return __builtin_cpu_supports("avx512f");
+                case isa_avx2: return __builtin_cpu_supports("avx2");
+                default: return i != isa_count;
+            }
+#else
+            return i == isa_auto || i == isa_scalar;
+#endif
+        }
+
+        //the isa isa_name() gives name, or isa_count if there's none
+        static sphere_isa find_isa(const char *name)
+        {
+            int i = 0;
+            while (i < isa_count && strcmp(name, isa_name(sphere_isa(i))) != 0)
+            {
+                i++;
+            }
+            return sphere_isa(i);
+        }
+
+        static const char *isa_name(sphere_isa i)
+        {
+            switch (i)
+            {
+                case isa_avx512: return "avx512";
+                case isa_avx2: return "avx2";
+                case isa_scalar: return "scalar";
+                default: return "auto";
+            }
+        }
+
+        int count;
+        std::vector<float> cx, cy, cz;
+        std::vector<float> radius;
+        std::vector<uint32_t> mat_id;
+        std::vector<const hitable*> sources; //not padded, since only hits read it
+        aabb box;
+        sphere_isa isa;
+
+    private:
+        //each closest_* returns the index of the closest sphere hit in (t_min, t_max), or -1,
+        //and sets t_hit to its t; on a tie the lower index wins, like hitable_list
+
+        int closest_scalar(const ray& r, float t_min, float t_max, float& t_hit) const
+        {
+            vec3 o = r.origin();
+            vec3 d = r.direction();
+            float a = vec3::dot(d, d);
+            int best = -1;
+
+            for (int i = 0; i < count; i++)
+            {
+                float ocx = o.x() - cx[i], ocy = o.y() - cy[i], ocz = o.z() - cz[i];
+                float b = 2.0f * (ocx * d.x() + ocy * d.y() + ocz * d.z());
+                float c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius[i] * radius[i];
+                float discriminant = b*b - 4*a*c;
+                if (discriminant > 0)
+                {
+                    float root = sqrtf(discriminant);
+                    float temp = (-b - root) / (2.0f*a);
+                    if (!(temp < t_max && temp > t_min))
+                    {
+                        temp = (-b + root) / (2.0f*a);
+                    }
+                    if (temp < t_max && temp > t_min)
+                    {
+                        t_max = temp;
+                        best = i;
+                    }
+                }
+            }
+
+            t_hit = t_max;
+            return best;
+        }
+
+#ifdef SPHERE_BATCH_X86
+        __attribute__((target("avx2"), optimize("fp-contract=off")))
+        int closest_avx2(const ray& r, float t_min, float t_max, float& t_hit) const
+        {
+            vec3 o = r.origin();
+            vec3 d = r.direction();
+            float a = vec3::dot(d, d);
+
+            const __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()), oz = _mm256_set1_ps(o.z());
+            const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()), dz = _mm256_set1_ps(d.z());
+            const __m256 four_a = _mm256_set1_ps(4*a);
+            const __m256 inv_two_a = _mm256_set1_ps(1.0f / (2.0f*a));
+            const __m256 two = _mm256_set1_ps(2.0f);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 vt_min = _mm256_set1_ps(t_min);
+            const __m256 vt_max = _mm256_set1_ps(t_max);
+
+            __m256 best_t = vt_max;
+            __m256i best_i = _mm256_set1_epi32(-1);
+            __m256i lane_i = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i step = _mm256_set1_epi32(8);
+
+            for (int i = 0; i < count; i += 8)
+            {
+                __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&cx[i]));
+                __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&cy[i]));
+                __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&cz[i]));
+                __m256 rad = _mm256_loadu_ps(&radius[i]);
+
+                __m256 b = _mm256_mul_ps(two, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                                                            _mm256_mul_ps(ocz, dz)));
+                __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                                       _mm256_mul_ps(ocz, ocz)),
+                                         _mm256_mul_ps(rad, rad));
+                __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(four_a, c));
+                __m256 has_roots = _mm256_cmp_ps(disc, zero, _CMP_GT_OQ);
+
+                __m256 root = _mm256_sqrt_ps(disc);
+                __m256 neg_b = _mm256_sub_ps(zero, b);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(neg_b, root), inv_two_a);
+                __m256 t1 = _mm256_mul_ps(_mm256_add_ps(neg_b, root), inv_two_a);
+                __m256 ok0 = _mm256_and_ps(_mm256_cmp_ps(t0, vt_max, _CMP_LT_OQ), _mm256_cmp_ps(t0, vt_min, _CMP_GT_OQ));
+                __m256 t = _mm256_blendv_ps(t1, t0, ok0);
+
+                //closer than what this lane has seen so far (which is at most t_max)
+                __m256 closer = _mm256_and_ps(has_roots, _mm256_and_ps(_mm256_cmp_ps(t, vt_min, _CMP_GT_OQ),
+                                                                        _mm256_cmp_ps(t, best_t, _CMP_LT_OQ)));
+                best_t = _mm256_blendv_ps(best_t, t, closer);
+                best_i = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_i), _mm256_castsi256_ps(lane_i), closer));
+                lane_i = _mm256_add_epi32(lane_i, step);
+            }
+
+            float ts[8];
+            int is[8];
+            _mm256_storeu_ps(ts, best_t);
+            _mm256_storeu_si256((__m256i*)is, best_i);
+            return reduce_lanes(ts, is, 8, t_max, t_hit);
+        }
+
+        //contraction into FMAs is turned off so the roots round the same way as the scalar quadratic
+        __attribute__((target("avx512f"), optimize("fp-contract=off")))
+        int closest_avx512(const ray& r, float t_min, float t_max, float& t_hit) const
+        {
+            vec3 o = r.origin();
+            vec3 d = r.direction();
+            float a = vec3::dot(d, d);
+
+            const __m512 ox = _mm512_set1_ps(o.x()), oy = _mm512_set1_ps(o.y()), oz = _mm512_set1_ps(o.z());
+            const __m512 dx = _mm512_set1_ps(d.x()), dy = _mm512_set1_ps(d.y()), dz = _mm512_set1_ps(d.z());
+            const __m512 four_a = _mm512_set1_ps(4*a);
+            const __m512 inv_two_a = _mm512_set1_ps(1.0f / (2.0f*a));
+            const __m512 two = _mm512_set1_ps(2.0f);
+            const __m512 zero = _mm512_setzero_ps();
+            const __m512 vt_min = _mm512_set1_ps(t_min);
+            const __m512 vt_max = _mm512_set1_ps(t_max);
+
+            __m512 best_t = vt_max;
+            __m512i best_i = _mm512_set1_epi32(-1);
+            __m512i lane_i = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            const __m512i step = _mm512_set1_epi32(16);
+
+            for (int i = 0; i < count; i += 16)
+            {
+                __m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&cx[i]));
+                __m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&cy[i]));
+                __m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&cz[i]));
+                __m512 rad = _mm512_loadu_ps(&radius[i]);
+
+                __m512 b = _mm512_mul_ps(two, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, dx), _mm512_mul_ps(ocy, dy)),
+                                                            _mm512_mul_ps(ocz, dz)));
+                __m512 c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)),
+                                                       _mm512_mul_ps(ocz, ocz)),
+                                         _mm512_mul_ps(rad, rad));
+                __m512 disc = _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_mul_ps(four_a, c));
+                __mmask16 has_roots = _mm512_cmp_ps_mask(disc, zero, _CMP_GT_OQ);
+
+                __m512 root = _mm512_mask_sqrt_ps(zero, has_roots, disc);
+                __m512 neg_b = _mm512_sub_ps(zero, b);
+                __m512 t0 = _mm512_mul_ps(_mm512_sub_ps(neg_b, root), inv_two_a);
+                __m512 t1 = _mm512_mul_ps(_mm512_add_ps(neg_b, root), inv_two_a);
+                __mmask16 ok0 = _mm512_cmp_ps_mask(t0, vt_max, _CMP_LT_OQ) & _mm512_cmp_ps_mask(t0, vt_min, _CMP_GT_OQ);
+                __m512 t = _mm512_mask_blend_ps(ok0, t1, t0);
+
+                __mmask16 closer = has_roots & _mm512_cmp_ps_mask(t, vt_min, _CMP_GT_OQ)
+                                             & _mm512_cmp_ps_mask(t, best_t, _CMP_LT_OQ);
+                best_t = _mm512_mask_blend_ps(closer, best_t, t);
+                best_i = _mm512_mask_blend_epi32(closer, best_i, lane_i);
+                lane_i = _mm512_add_epi32(lane_i, step);
+            }
+
+            float ts[16];
+            int is[16];
+            _mm512_storeu_ps(ts, best_t);
+            _mm512_storeu_si512(is, best_i);
+            return reduce_lanes(ts, is, 16, t_max, t_hit);
+        }
+#endif
+
+        //picks the closest of the per-lane winners, lowest index on a tie
+        static int reduce_lanes(const float *ts, const int *is, int lanes, float t_max, float& t_hit)
+        {
+            int best = -1;
+            float best_t = t_max;
+            for (int l = 0; l < lanes; l++)
+            {
+                if (is[l] >= 0 && (ts[l] < best_t || (ts[l] == best_t && is[l] < best)))
+                {
+                    best_t = ts[l];
+                    best = is[l];
+                }
+            }
+            t_hit = best_t;
+            return best;
+        }
+};
+
+/* regroups the spheres in list into sphere_batches of up to batch_size nearby spheres each,
+ * allocated from mem, and appends them to out
+ * spheres are grouped in BVH leaf order so each batch covers a compact region;
+ * anything that isn't a sphere is appended to out unchanged
+ */
+void batch_spheres(arena& mem, hitable **list, int n, std::vector<hitable*>& out, int batch_size = 16,
+                   sphere_isa isa = isa_auto)
+{
+    std::vector<hitable*> spheres;
+    for (int i = 0; i < n; i++)
+    {
+        if (dynamic_cast<sphere*>(list[i]))
+        {
+            spheres.push_back(list[i]);
+        }
+        else
+        {
+            out.push_back(list[i]);
+        }
+    }
+
+    bvh order(spheres.data(), int(spheres.size()));
+
+    sphere_batch *batch = 0;
+    for (size_t i = 0; i < order.prims.size(); i++)
+    {
+        if (i % batch_size == 0)
+        {
+            batch = mem.make<sphere_batch>(isa);
+            out.push_back(batch);
+        }
+        sphere *s = static_cast<sphere*>(order.prims[i]);
+        batch->add(s->center, s->radius, s->mat_id, s);
+    }
+}
+
+#endif
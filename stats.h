@@ -0,0 +1,195 @@
+/* stats.h
+ * Optional render statistics: how many rays, box, sphere, triangle and plane tests, scatters of each material,
+ * how paths ended and how long they got, plus wall-clock timers for the main phases
+ * only compiled in when RT_STATS is defined (cmake -DRT_STATS=ON); otherwise every STATS_ macro
+ * expands to nothing and the renderer is exactly the code it was without them
+ * counters are per-thread plain increments, merged into the totals by STATS_FLUSH()
+ * when a render thread finishes its tiles, so the hot path never touches shared memory
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef STATSH
+#define STATSH
+
+#ifdef RT_STATS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+
+enum stats_counter
+{
+    stat_paths,              //camera samples shaded
+    stat_rays,               //rays intersected with the scene, camera and bounce rays alike
+    stat_shadow_rays,        //rays aimed at lights, which only ask whether anything is in the way
+    stat_bvh_nodes,          //BVH nodes visited by single rays
+    stat_list_hits,          //hitable_list::hit calls
+    stat_sphere_tests,       //ray/sphere intersection tests
+    stat_sphere_hits,        //...that found a hit in range
+    stat_batch_tests,        //sphere_batch::hit calls (16 spheres each)
+    stat_triangle_tests,     //ray/triangle intersection tests, in meshes
+    stat_triangle_hits,      //...leaves of them that had a closer hit
+    stat_plane_tests,        //ray/plane intersection tests
+    stat_scatter_lambertian,
+    stat_scatter_metal,
+    stat_scatter_dielectric,
+    stat_escaped,            //paths that ended in the sky
+    stat_lit,                //paths that ended on a light
+    stat_absorbed,           //paths whose scatter() failed
+    stat_roulette,           //paths ended by russian roulette
+    stat_depth_capped,       //paths cut off at max_depth
+    stat_counter_count
+};
+
+const char *stats_counter_names[stat_counter_count] =
+{
+    "paths", "rays", "shadow_rays", "bvh_nodes", "list_hits", "sphere_tests", "sphere_hits", "batch_tests",
+    "triangle_tests", "triangle_hits", "plane_tests",
+    "scatter_lambertian", "scatter_metal", "scatter_dielectric",
+    "escaped", "lit", "absorbed", "roulette", "depth_capped"
+};
+
+enum stats_timer
+{
+    timer_scene_load,
+    timer_accel_build,
+    timer_render,
+    timer_output,
+    timer_denoise,
+    timer_count
+};
+
+const char *stats_timer_names[timer_count] = { "scene_load", "accel_build", "render", "output", "denoise" };
+
+const int stats_max_depth = 64; //paths this long or longer share the histogram's last bucket
+
+struct stats_block
+{
+    uint64_t counters[stat_counter_count];
+    uint64_t depth[stats_max_depth + 1]; //number of paths that ended after this many bounces
+
+    void add(const stats_block& b)
+    {
+        for (int c = 0; c < stat_counter_count; c++)
+        {
+            counters[c] += b.counters[c];
+        }
+        for (int d = 0; d <= stats_max_depth; d++)
+        {
+            depth[d] += b.depth[d];
+        }
+    }
+};
+
+//this thread's counts since its last flush; zero-initialized, so touching it costs no init check
+inline thread_local stats_block thread_stats;
+
+inline stats_block total_stats;
+inline double timer_ms[timer_count];
+inline std::mutex stats_lock;
+
+//moves this thread's counts into the totals
+inline void stats_flush()
+{
+    std::lock_guard<std::mutex> guard(stats_lock);
+    total_stats.add(thread_stats);
+    memset(&thread_stats, 0, sizeof(thread_stats));
+}
+
+inline void stats_end_path(int depth, stats_counter how)
+{
+    thread_stats.counters[how]++;
+    thread_stats.depth[depth < stats_max_depth ? depth : stats_max_depth]++;
+}
+
+//adds the time between its construction and destruction to one of the timers
+class scoped_timer
+{
+    public:
+        scoped_timer(stats_timer t) : timer(t), start(std::chrono::steady_clock::now()) {}
+        ~scoped_timer()
+        {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> guard(stats_lock);
+            timer_ms[timer] += ms;
+        }
+
+    private:
+        stats_timer timer;
+        std::chrono::steady_clock::time_point start;
+};
+
+/* writes the totals, a few ratios and the path depth histogram (up to the deepest bucket used) as JSON
+ * call after every thread has flushed
+ */
+bool write_stats_report(const char *path, int max_depth)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        return false;
+    }
+    stats_flush(); //whatever the calling thread counted outside a render
+
+    const uint64_t *c = total_stats.counters;
+    auto ratio = [](uint64_t a, uint64_t b) { return b ? double(a) / double(b) : 0.0; };
+    fprintf(f, "{\n  \"counters\": {\n");
+    for (int k = 0; k < stat_counter_count; k++)
+    {
+        fprintf(f, "    \"%s\": %llu%s\n", stats_counter_names[k], (unsigned long long)c[k],
+                k + 1 < stat_counter_count ? "," : "");
+    }
+    //shadow rays walk the tree too, so they count as rays here
+    uint64_t rays = c[stat_rays] + c[stat_shadow_rays];
+    fprintf(f, "  },\n  \"per_ray\": {\n");
+    fprintf(f, "    \"bvh_nodes\": %.3f,\n", ratio(c[stat_bvh_nodes], rays));
+    fprintf(f, "    \"sphere_tests\": %.3f,\n", ratio(c[stat_sphere_tests], rays));
+    fprintf(f, "    \"sphere_hit_rate\": %.4f,\n", ratio(c[stat_sphere_hits], c[stat_sphere_tests]));
+    fprintf(f, "    \"triangle_tests\": %.3f\n", ratio(c[stat_triangle_tests], rays));
+    fprintf(f, "  },\n  \"rays_per_path\": %.3f,\n", ratio(c[stat_rays], c[stat_paths]));
+
+    int deepest = 0;
+    for (int d = 0; d <= stats_max_depth; d++)
+    {
+        if (total_stats.depth[d] > 0)
+        {
+            deepest = d;
+        }
+    }
+    fprintf(f, "  \"max_depth\": %d,\n  \"depth_histogram\": [", max_depth);
+    for (int d = 0; d <= deepest; d++)
+    {
+        fprintf(f, "%s%llu", d ? ", " : "", (unsigned long long)total_stats.depth[d]);
+    }
+    fprintf(f, "],\n  \"timers_ms\": {\n");
+    for (int t = 0; t < timer_count; t++)
+    {
+        fprintf(f, "    \"%s\": %.3f%s\n", stats_timer_names[t], timer_ms[t], t + 1 < timer_count ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+
+    bool good = ferror(f) == 0;
+    return fclose(f) == 0 && good;
+}
+
+#define STATS_COUNT(c) (thread_stats.counters[c]++)
+#define STATS_ADD(c, n) (thread_stats.counters[c] += (n))
+#define STATS_END_PATH(depth, how) stats_end_path(depth, how)
+#define STATS_FLUSH() stats_flush()
+#define STATS_TIMER(t) scoped_timer stats_scoped_##t(t)
+
+#else
+
+#define STATS_COUNT(c) ((void)0)
+#define STATS_ADD(c, n) ((void)0)
+#define STATS_END_PATH(depth, how) ((void)0)
+#define STATS_FLUSH() ((void)0)
+#define STATS_TIMER(t) ((void)0)
+
+#endif
+
+#endif
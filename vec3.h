@@ -1,7 +1,15 @@
 /* vec3.h
  * Defines the vec3 class for vectors
  * based on the ray-tracing tutorial at https://www.realtimerendering.com/raytracing/Ray%20Tracing%20in%20a%20Weekend.pdf
- * 
+ *
+ * the storage behind a vec3 is picked at compile time (cmake -DRT_VEC3=...):
+ *   scalar  three floats, the default
+ *   simd    four floats, 16-byte aligned, one SSE or NEON register (RT_VEC3_SIMD);
+ *           the fourth lane is padding, never read by dot, length or the accessors
+ *   double  three doubles (RT_VEC3_DOUBLE), for checking how much float precision costs the image
+ * the interface is the same for all three; the scalar and simd backends do the same float operations
+ * in the same order, so they render the same image
+ *
  * Melody Mao
  * Fall 2019
  */
@@ -13,25 +21,176 @@
 #include <stdlib.h>
 #include <iostream>
 
-class vec3 {
+#if defined(RT_VEC3_SIMD) && defined(__SSE2__)
+#define VEC3_SSE
+#define VEC3_BACKEND "simd (sse)"
+#include <emmintrin.h>
+#elif defined(RT_VEC3_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#define VEC3_NEON
+#define VEC3_BACKEND "simd (neon)"
+#include <arm_neon.h>
+#elif defined(RT_VEC3_SIMD)
+#error "RT_VEC3_SIMD needs SSE2 or AArch64 NEON"
+#endif
+
+#if defined(RT_VEC3_DOUBLE) && defined(RT_VEC3_SIMD)
+#error "pick one of RT_VEC3_SIMD and RT_VEC3_DOUBLE"
+#elif defined(RT_VEC3_DOUBLE)
+#define VEC3_BACKEND "double"
+#elif !defined(RT_VEC3_SIMD)
+#define VEC3_BACKEND "scalar"
+#endif
+
+#if defined(VEC3_SSE) || defined(VEC3_NEON)
+
+//lane-wise helpers for the simd backend, so the class below only has one version of each operator
+#ifdef VEC3_SSE
+typedef __m128 vec3_lanes;
+static inline vec3_lanes lanes_set(float x, float y, float z) { return _mm_set_ps(0, z, y, x); }
+static inline vec3_lanes lanes_splat(float t) { return _mm_set1_ps(t); }
+static inline vec3_lanes lanes_add(vec3_lanes a, vec3_lanes b) { return _mm_add_ps(a, b); }
+static inline vec3_lanes lanes_sub(vec3_lanes a, vec3_lanes b) { return _mm_sub_ps(a, b); }
+static inline vec3_lanes lanes_mul(vec3_lanes a, vec3_lanes b) { return _mm_mul_ps(a, b); }
+static inline vec3_lanes lanes_div(vec3_lanes a, vec3_lanes b) { return _mm_div_ps(a, b); }
+//flips the sign of x, y and z only, so the padding stays +0
+static inline vec3_lanes lanes_neg(vec3_lanes a) { return _mm_xor_ps(a, _mm_set_ps(0, -0.0f, -0.0f, -0.0f)); }
+//x + y + z, added in that order like the scalar version
+static inline float lanes_sum(vec3_lanes a)
+{
+    __m128 s = _mm_add_ss(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(a, a)));
+}
+/* (a1*b2 - a2*b1, -(a0*b2 - a2*b0), a0*b1 - a1*b0), the exact expressions the scalar cross computes;
+ * the middle one is negated afterwards rather than swapped, which would give +0 where scalar gives -0
+ */
+static inline vec3_lanes lanes_cross(vec3_lanes a, vec3_lanes b)
+{
+    __m128 l = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 2, 2)));
+    __m128 r = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 2, 2)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 0, 1)));
+    return _mm_xor_ps(_mm_sub_ps(l, r), _mm_set_ps(0, 0, -0.0f, 0));
+}
+#else
+typedef float32x4_t vec3_lanes;
+static inline vec3_lanes lanes_set(float x, float y, float z)
+{
+    float e[4] = { x, y, z, 0 };
+    return vld1q_f32(e);
+}
+static inline vec3_lanes lanes_splat(float t) { return vdupq_n_f32(t); }
+static inline vec3_lanes lanes_add(vec3_lanes a, vec3_lanes b) { return vaddq_f32(a, b); }
+static inline vec3_lanes lanes_sub(vec3_lanes a, vec3_lanes b) { return vsubq_f32(a, b); }
+static inline vec3_lanes lanes_mul(vec3_lanes a, vec3_lanes b) { return vmulq_f32(a, b); }
+static inline vec3_lanes lanes_div(vec3_lanes a, vec3_lanes b) { return vdivq_f32(a, b); }
+static inline vec3_lanes lanes_neg(vec3_lanes a)
+{
+    const uint32_t sign[4] = { 0x80000000u, 0x80000000u, 0x80000000u, 0 };
+    return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), vld1q_u32(sign)));
+}
+static inline float lanes_sum(vec3_lanes a)
+{
+    return vgetq_lane_f32(a, 0) + vgetq_lane_f32(a, 1) + vgetq_lane_f32(a, 2);
+}
+static inline vec3_lanes lanes_cross(vec3_lanes a, vec3_lanes b)
+{
+    float x = vgetq_lane_f32(a, 1) * vgetq_lane_f32(b, 2) - vgetq_lane_f32(a, 2) * vgetq_lane_f32(b, 1);
+    float y = -(vgetq_lane_f32(a, 0) * vgetq_lane_f32(b, 2) - vgetq_lane_f32(a, 2) * vgetq_lane_f32(b, 0));
+    float z = vgetq_lane_f32(a, 0) * vgetq_lane_f32(b, 1) - vgetq_lane_f32(a, 1) * vgetq_lane_f32(b, 0);
+    return lanes_set(x, y, z);
+}
+#endif
+
+class alignas(16) vec3 {
 public:
+    typedef float real;
+
     //constructors
-    vec3() {}
-    vec3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+    vec3() : v(lanes_splat(0)) {}
+    vec3(float e0, float e1, float e2) : v(lanes_set(e0, e1, e2)) {}
+    explicit vec3(vec3_lanes l) : v(l) {}
     inline float x() const { return e[0]; }
     inline float y() const { return e[1]; }
     inline float z() const { return e[2]; }
     inline float r() const { return e[0]; }
     inline float g() const { return e[1]; }
     inline float b() const { return e[2]; }
+
+    //overloaded operators
+    inline const vec3& operator+() const { return *this; }
+    inline vec3 operator-() const { return vec3(lanes_neg(v)); }
+    inline float operator[](int i) const { return e[i]; }
+    inline float& operator[](int i) { return e[i]; }
+
+    inline vec3& operator+=(const vec3 &v2) { v = lanes_add(v, v2.v); return *this; }
+    inline vec3& operator-=(const vec3 &v2) { v = lanes_sub(v, v2.v); return *this; }
+    inline vec3& operator*=(const vec3 &v2) { v = lanes_mul(v, v2.v); return *this; }
+    inline vec3& operator/=(const vec3 &v2) { v = lanes_div(v, v2.v); return *this; }
+    inline vec3& operator*=(const float t) { v = lanes_mul(v, lanes_splat(t)); return *this; }
+    inline vec3& operator/=(const float t)
+    {
+        float k = 1.0/t;
+        v = lanes_mul(v, lanes_splat(k));
+        return *this;
+    }
+
+    inline vec3 operator+(const vec3 &v2) const { return vec3(lanes_add(v, v2.v)); }
+    inline vec3 operator-(const vec3 &v2) const { return vec3(lanes_sub(v, v2.v)); }
+    inline vec3 operator*(const vec3 &v2) const { return vec3(lanes_mul(v, v2.v)); }
+    inline vec3 operator/(const vec3 &v2) const { return vec3(lanes_div(v, v2.v)); }
+
+    //vector op functions
+
+    inline float length() const { return sqrt(squared_length()); }
+    inline float squared_length() const { return lanes_sum(lanes_mul(v, v)); }
+
+    inline void make_unit_vector()
+    {
+        float k = 1.0 / sqrt(squared_length());
+        v = lanes_mul(v, lanes_splat(k));
+    }
+
+    //static functions
+
+    static inline float dot(const vec3 &v1, const vec3 &v2) { return lanes_sum(lanes_mul(v1.v, v2.v)); }
+    static inline vec3 cross(const vec3 &v1, const vec3 &v2) { return vec3(lanes_cross(v1.v, v2.v)); }
+    static inline vec3 scale(const vec3 &v, float t) { return vec3(lanes_mul(lanes_splat(t), v.v)); }
+    //a + b * t, e.g. a point along a ray
+    static inline vec3 mul_add(const vec3 &a, const vec3 &b, float t)
+    {
+        return vec3(lanes_add(a.v, lanes_mul(lanes_splat(t), b.v)));
+    }
+
+    union
+    {
+        vec3_lanes v;
+        float e[4];
+    };
+#else
+
+class vec3 {
+public:
+#ifdef RT_VEC3_DOUBLE
+    typedef double real;
+#else
+    typedef float real;
+#endif
+
+    //constructors
+    vec3() {}
+    vec3(real e0, real e1, real e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+    inline real x() const { return e[0]; }
+    inline real y() const { return e[1]; }
+    inline real z() const { return e[2]; }
+    inline real r() const { return e[0]; }
+    inline real g() const { return e[1]; }
+    inline real b() const { return e[2]; }
     //these inlines basically function the way we used macros in graphics;
     //but macros are discouraged in C++
 
     //overloaded operators
     inline const vec3& operator+() const { return *this; }
     inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    inline float operator[](int i) const { return e[i]; }
-    inline float& operator[](int i) { return e[i]; }
+    inline real operator[](int i) const { return e[i]; }
+    inline real& operator[](int i) { return e[i]; }
     //const return value vs const member function vs const function parameter (vs const variable)
 
     inline vec3& operator+=(const vec3 &v2)
@@ -70,7 +229,7 @@ public:
         return *this;
     }
 
-    inline vec3& operator*=(const float t)
+    inline vec3& operator*=(const real t)
     {
         e[0] *= t;
         e[1] *= t;
@@ -79,9 +238,9 @@ public:
         return *this;
     }
 
-    inline vec3& operator/=(const float t)
+    inline vec3& operator/=(const real t)
     {
-        float k = 1.0/t;
+        real k = 1.0/t;
         e[0] *= k;
         e[1] *= k;
         e[2] *= k;
@@ -111,18 +270,18 @@ public:
 
     //vector op functions
 
-    inline float length() const
+    inline real length() const
     {
         return sqrt( e[0] * e[0] + e[1] * e[1] + e[2] * e[2] );
     }
-    inline float squared_length() const
+    inline real squared_length() const
     {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
-    
+
     inline void make_unit_vector()
     {
-        float k = 1.0 / sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+        real k = 1.0 / sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
         e[0] *= k;
         e[1] *= k;
         e[2] *= k;
@@ -130,7 +289,7 @@ public:
 
     //static functions
 
-    static inline float dot(const vec3 &v1, const vec3 &v2)
+    static inline real dot(const vec3 &v1, const vec3 &v2)
     {
         return v1.e[0] * v2.e[0] + v1.e[1] * v2.e[1] + v1.e[2] * v2.e[2];
     }
@@ -143,17 +302,41 @@ public:
                     );
     }
 
-    static inline vec3 unit_vector(vec3 v)
+    static inline vec3 scale(const vec3 &v, real t)
     {
-        return scale(v, 1.0/v.length());
+        return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
     }
 
-    static inline vec3 scale(vec3 v, float t)
+    //a + b * t, e.g. a point along a ray
+    static inline vec3 mul_add(const vec3 &a, const vec3 &b, real t)
     {
-        return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+        return vec3(a.e[0] + t * b.e[0], a.e[1] + t * b.e[1], a.e[2] + t * b.e[2]);
+    }
+
+    real e[3];
+#endif
+
+    //operations built from the ones above, the same for every backend
+
+    /* v scaled to length 1
+     * divides in real rather than in double like the original 1.0/length(); for floats the quotient
+     * of two floats rounded once is the same value either way, without the two conversions
+     */
+    static inline vec3 normalize(const vec3 &v)
+    {
+        return scale(v, real(1) / sqrt(v.squared_length()));
     }
 
-    float e[3];
+    static inline vec3 unit_vector(const vec3 &v)
+    {
+        return normalize(v);
+    }
+
+    //v mirrored about the plane with normal n
+    static inline vec3 reflect(const vec3 &v, const vec3 &n)
+    {
+        return v - scale(n, 2*dot(v, n));
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
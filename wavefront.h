@@ -0,0 +1,223 @@
+/* wavefront.h
+ * Defines render_tile_wavefront, which renders a tile breadth-first instead of one path at a time
+ * every sample of the tile starts as a path in one big queue; each bounce then runs as stages
+ * over the whole queue: intersect every ray, sort the hits by material type, and scatter
+ * each material's hits as one contiguous batch with a direct (non-virtual) call
+ * that way the branch predictor and instruction cache see long runs of the same material
+ * instead of lambertian/metal/dielectric picked at random on every bounce
+ * each path makes the same choices as shade(), so the image is identical to render_tile()
+ * in scenes without lights; it doesn't do light sampling, so scenes with them render through shade()
+ * see Laine, Karras and Aila, "Megakernels Considered Harmful: Wavefront Path Tracing on GPUs" (2013)
+ *
+ * Melody Mao
+ * Fall 2019
+ */
+
+#ifndef WAVEFRONTH
+#define WAVEFRONTH
+
+#include <stdint.h>
+#include <vector>
+#include "renderer.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "dielectric.h"
+
+//one path in flight
+struct wavefront_path
+{
+    ray r;
+    vec3 throughput;
+    rng gen;
+    uint32_t slot; //where its result goes: pixel in tile * samples per pixel + sample
+    int depth;
+};
+
+//queues reused from tile to tile, so a thread only allocates them once
+struct wavefront_queues
+{
+    std::vector<wavefront_path> paths;
+    std::vector<wavefront_path> next;
+    std::vector<hit_record> hits;
+    std::vector<uint8_t> hit_flags;
+    std::vector<uint32_t> order; //path indices sorted by material type
+    std::vector<vec3> radiance;  //result of every sample in the tile
+};
+
+//calls M's scatter directly; the qualified M::scatter call skips the vtable, so it can be inlined
+template <typename M>
+inline bool scatter_as(const material *m, const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered,
+                       rng& gen)
+{
+    return static_cast<const M*>(m)->M::scatter(r_in, rec, attenuation, scattered, gen);
+}
+
+//materials of any other class still go through the virtual call
+template <>
+inline bool scatter_as<material>(const material *m, const ray& r_in, const hit_record& rec, vec3& attenuation,
+                                 ray& scattered, rng& gen)
+{
+    return m->scatter(r_in, rec, attenuation, scattered, gen);
+}
+
+/* scatters the paths order[begin, end), which all hit a material of concrete type M
+ * survivors are appended to next
+ */
+template <typename M>
+void scatter_batch(wavefront_queues& q, uint32_t begin, uint32_t end, const scene& sc, const path_settings& ps)
+{
+    for (uint32_t k = begin; k < end; k++)
+    {
+        uint32_t index = q.order[k];
+        wavefront_path& p = q.paths[index];
+        const hit_record& rec = q.hits[index];
+
+        ray scattered;
+        vec3 attenuation;
+
+        p.gen.start_bounce(p.depth + 1);
+        if (p.depth >= ps.max_depth)
+        {
+            STATS_END_PATH(p.depth, stat_depth_capped);
+            continue; //contributes black, which radiance already holds
+        }
+
+        if (!scatter_as<M>(sc.get_material(rec.mat_id), p.r, rec, attenuation, scattered, p.gen))
+        {
+            STATS_END_PATH(p.depth, stat_absorbed);
+            continue;
+        }
+        p.throughput *= attenuation;
+
+        //same russian roulette as shade()
+        if (ps.rr_depth > 0 && p.depth + 1 >= ps.rr_depth)
+        {
+            float survival = fmaxf(p.throughput.r(), fmaxf(p.throughput.g(), p.throughput.b()));
+            survival = fminf(1.0f, fmaxf(survival, ps.rr_min_survival));
+            if (p.gen.next() >= survival)
+            {
+                STATS_END_PATH(p.depth + 1, stat_roulette);
+                continue;
+            }
+            p.throughput /= survival;
+        }
+
+        p.r = scattered;
+        p.depth++;
+        q.next.push_back(p);
+    }
+}
+
+/* renders one tile breadth-first; returns the number of samples taken
+ * rays is increased by the number of rays intersected with the scene
+ * adaptive sampling needs each pixel's samples one after another, so it isn't supported here;
+ * every pixel gets rs.sampling.max_samples
+ */
+uint64_t render_tile_wavefront(const tile& t, const scene& sc, const camera& cam, const render_settings& rs,
+                               framebuffer& fb, wavefront_queues& q, uint64_t& rays)
+{
+    int spp = rs.sampling.max_samples;
+    int tile_w = t.x1 - t.x0;
+    int pixels = tile_w * (t.y1 - t.y0);
+
+    q.radiance.assign(size_t(pixels) * spp, vec3(0, 0, 0));
+    q.paths.clear();
+
+    STATS_ADD(stat_paths, uint64_t(pixels) * spp);
+
+    //camera rays for every sample in the tile
+    for (int j = t.y0; j < t.y1; j++)
+    {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+            uint32_t pixel = (j - t.y0) * tile_w + (i - t.x0);
+            for (int s = 0; s < spp; s++)
+            {
+                wavefront_path p;
+                p.gen = rng(j * rs.width + i, s, rs.source);
+                float u = float(i + p.gen.next()) / float(rs.width);
+                float v = float(j + p.gen.next()) / float(rs.height);
+                p.r = cam.get_ray(u, v, p.gen);
+                p.throughput = vec3(1, 1, 1);
+                p.slot = pixel * spp + s;
+                p.depth = 0;
+                q.paths.push_back(p);
+            }
+        }
+    }
+
+    while (!q.paths.empty())
+    {
+        uint32_t n = uint32_t(q.paths.size());
+        q.hits.resize(n);
+        q.hit_flags.resize(n);
+
+        //stage 1: intersect every ray
+        for (uint32_t k = 0; k < n; k++)
+        {
+            q.hit_flags[k] = sc.world->hit(q.paths[k].r, 0.001, MAXFLOAT, q.hits[k]);
+        }
+        rays += n;
+        STATS_ADD(stat_rays, n);
+
+        //stage 2: finish the paths that escaped, bin the rest by material type
+        uint32_t bin_start[material_type_count + 1] = { 0 };
+        for (uint32_t k = 0; k < n; k++)
+        {
+            if (q.hit_flags[k])
+            {
+                bin_start[sc.material_types[q.hits[k].mat_id] + 1]++;
+            }
+            else
+            {
+                q.radiance[q.paths[k].slot] = q.paths[k].throughput * world_sky(sc, q.paths[k].r);
+                STATS_END_PATH(q.paths[k].depth, stat_escaped);
+            }
+        }
+        for (int b = 0; b < material_type_count; b++)
+        {
+            bin_start[b + 1] += bin_start[b];
+        }
+        q.order.resize(bin_start[material_type_count]);
+        uint32_t fill[material_type_count];
+        for (int b = 0; b < material_type_count; b++)
+        {
+            fill[b] = bin_start[b];
+        }
+        for (uint32_t k = 0; k < n; k++)
+        {
+            if (q.hit_flags[k])
+            {
+                q.order[fill[sc.material_types[q.hits[k].mat_id]]++] = k;
+            }
+        }
+
+        //stage 3: scatter each material's batch, building the next bounce's queue
+        q.next.clear();
+        scatter_batch<lambertian>(q, bin_start[material_lambertian], bin_start[material_lambertian + 1], sc, rs.path);
+        scatter_batch<metal>(q, bin_start[material_metal], bin_start[material_metal + 1], sc, rs.path);
+        scatter_batch<dielectric>(q, bin_start[material_dielectric], bin_start[material_dielectric + 1], sc, rs.path);
+        //lights and anything else left go through the virtual call; lights absorb, as there's no light sampling here
+        scatter_batch<material>(q, bin_start[material_light], bin_start[material_other + 1], sc, rs.path);
+        q.paths.swap(q.next);
+    }
+
+    //sum each pixel's samples in order, like render_tile()
+    for (int j = t.y0; j < t.y1; j++)
+    {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+            uint32_t pixel = (j - t.y0) * tile_w + (i - t.x0);
+            pixel_estimate est;
+            for (int s = 0; s < spp; s++)
+            {
+                est.add(q.radiance[size_t(pixel) * spp + s]);
+            }
+            fb.set(i, j, est);
+        }
+    }
+
+    return uint64_t(pixels) * spp;
+}
+
+#endif